@@ -0,0 +1,284 @@
+#include "expression.hpp"
+#include "compiled_expression.hpp"
+#include "batch_evaluator.hpp"
+#include "expression_serialization.hpp"
+#include "incremental_evaluator.hpp"
+#include <sys/resource.h>
+#include <chrono>
+#include <complex>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct BenchResult {
+    std::string name;
+    size_t iterations = 0;
+    double ns_per_op = 0;
+    size_t nodes = 0;
+    double nodes_per_sec = 0;
+    double allocations_per_op = 0;
+    double copies_per_op = 0;
+    double visits_per_op = 0;
+    // Node memory the workload reserved on top of what was live before it.
+    double peak_node_kb = 0;
+};
+
+long peakRssKb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// ru_maxrss is a process-wide high-water mark, so per-workload memory is
+// taken from the node arenas instead (both value types are benchmarked).
+size_t arenaBytes() {
+    return Expression<double>::allocation_stats().arena_bytes +
+           Expression<std::complex<double>>::allocation_stats().arena_bytes;
+}
+
+size_t peakArenaBytes() {
+    return Expression<double>::allocation_stats().peak_arena_bytes +
+           Expression<std::complex<double>>::allocation_stats().peak_arena_bytes;
+}
+
+void resetArenaPeaks() {
+    Expression<double>::reset_allocation_stats();
+    Expression<std::complex<double>>::reset_allocation_stats();
+}
+
+// Repeats `op` until at least `min_seconds` have elapsed; `nodes` is the
+// size of the input the operation walks and drives nodes/sec.
+BenchResult run(const std::string& name, size_t nodes, const std::function<void()>& op, double min_seconds = 0.2) {
+    using Clock = std::chrono::steady_clock;
+    resetArenaPeaks();
+    const size_t baseline = arenaBytes();
+    op();
+
+#ifdef EXPRESSION_COUNTERS
+    expression_counters::reset();
+#endif
+    size_t iterations = 0;
+    auto start = Clock::now();
+    double elapsed = 0;
+    do {
+        op();
+        iterations++;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < min_seconds);
+
+    BenchResult result;
+    result.name = name;
+    result.iterations = iterations;
+    result.ns_per_op = elapsed * 1e9 / iterations;
+    result.nodes = nodes;
+    result.nodes_per_sec = nodes * iterations / elapsed;
+#ifdef EXPRESSION_COUNTERS
+    result.allocations_per_op = double(expression_counters::node_allocations) / iterations;
+    result.copies_per_op = double(expression_counters::copies) / iterations;
+    result.visits_per_op = double(expression_counters::evaluation_visits) / iterations;
+#endif
+    result.peak_node_kb = double(peakArenaBytes() - baseline) / 1024;
+    return result;
+}
+
+// Variable names are alphabetic only, so number them in base 26.
+std::string variableName(size_t index) {
+    std::string name = "v";
+    do {
+        name += static_cast<char>('a' + index % 26);
+        index /= 26;
+    } while (index > 0);
+    return name;
+}
+
+std::string deepNesting(size_t depth) {
+    std::string expr = "x";
+    for (size_t i = 0; i < depth; ++i) {
+        expr = (i % 2 ? "sin(" : "(1 + ") + expr + ")";
+    }
+    return expr;
+}
+
+std::string wideSum(size_t terms) {
+    std::string expr = "x";
+    for (size_t i = 1; i < terms; ++i) {
+        expr += " + " + std::to_string(i) + " * x ^ " + std::to_string(i % 7);
+    }
+    return expr;
+}
+
+std::string manyVariables(size_t count) {
+    std::string expr = variableName(0);
+    for (size_t i = 1; i < count; ++i) {
+        expr += (i % 3 ? " + " : " * ") + variableName(i);
+    }
+    return expr;
+}
+
+template <typename T>
+void evaluationBenchmarks(const std::string& suffix, T x_value, std::vector<BenchResult>& results) {
+    auto wide = Expression<T>::parse(wideSum(2000));
+    std::unordered_map<std::string, T> vars{{"x", x_value}};
+    volatile double sink = 0;
+
+    results.push_back(run("calculate_wide_" + suffix, wide.node_count(), [&] {
+        sink = std::abs(wide.calculate(vars));
+    }));
+
+    CompiledExpression<T> program(wide);
+    results.push_back(run("compiled_wide_" + suffix, wide.node_count(), [&] {
+        sink = std::abs(program.calculate(vars));
+    }));
+
+    auto formula = Expression<T>::parse("x * sin(y) + ln(x) / (y ^ 2 + 1) - exp(x / 10) * cos(x * y)");
+    CompiledExpression<T> compiled(formula);
+    BatchEvaluator<T> batch(compiled);
+    const size_t rows = 1 << 18;
+    std::vector<T> xs(rows), ys(rows), out(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        xs[i] = x_value * T(1 + static_cast<double>(i % 100));
+        ys[i] = T(static_cast<double>(i % 37) * 0.1);
+    }
+    const T* columns[2];
+    columns[compiled.slot("x")] = xs.data();
+    columns[compiled.slot("y")] = ys.data();
+    results.push_back(run("batch_rows_" + suffix, rows * formula.node_count(), [&] {
+        batch.evaluate(columns, rows, out.data());
+    }));
+    (void)sink;
+}
+
+void writeJson(std::ostream& out, const std::vector<BenchResult>& results) {
+    out << "{\n  \"peak_rss_kb\": " << peakRssKb() << ",\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"iterations\": " << r.iterations
+            << ", \"ns_per_op\": " << r.ns_per_op << ", \"nodes\": " << r.nodes
+            << ", \"nodes_per_sec\": " << r.nodes_per_sec
+            << ", \"allocations_per_op\": " << r.allocations_per_op
+            << ", \"copies_per_op\": " << r.copies_per_op
+            << ", \"visits_per_op\": " << r.visits_per_op
+            << ", \"peak_node_kb\": " << r.peak_node_kb << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+int main(int argc, char* argv[]) {
+    std::string jsonPath;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--json" && i + 1 < argc) {
+            jsonPath = argv[++i];
+        }
+    }
+
+    std::vector<BenchResult> results;
+
+    const std::string deep = deepNesting(2000);
+    const std::string wide = wideSum(5000);
+    const std::string vars = manyVariables(5000);
+    const std::string large = wideSum(200000);
+    // Node counts are taken up front: a live copy of the tree would turn
+    // every parse into intern-table hits.
+    const size_t deepNodes = Expression<double>::parse(deep).node_count();
+    const size_t wideNodes = Expression<double>::parse(wide).node_count();
+    const size_t largeNodes = Expression<double>::parse(large).node_count();
+    results.push_back(run("parse_deep", deepNodes, [&] {
+        Expression<double>::parse(deep);
+    }));
+    results.push_back(run("parse_wide", wideNodes, [&] {
+        Expression<double>::parse(wide);
+    }));
+    results.push_back(run("parse_large", largeNodes, [&] {
+        Expression<double>::parse(large);
+    }));
+
+    // Startup: re-parse and differentiate vs. mapping a saved derivative.
+    const std::string serializedPath = "bench_serialized.bin";
+    size_t derivativeNodes = 0;
+    {
+        auto wideExpr = Expression<double>::parse(wide);
+        results.push_back(run("to_string_wide", wideExpr.node_count(), [&] {
+            wideExpr.to_string();
+        }));
+        results.push_back(run("differentiate_wide", wideExpr.node_count(), [&] {
+            wideExpr.differentiate("x");
+        }));
+
+        auto wideDerivative = wideExpr.differentiate("x");
+        derivativeNodes = wideDerivative.node_count();
+        save_expressions<double>(serializedPath, {{"f", wideExpr}, {"d/dx", wideDerivative}});
+    }
+    // Both trees are released here, so the re-parse below allocates every
+    // node like a fresh process instead of hitting the intern table.
+    std::unordered_map<std::string, double> x{{"x", 0.5}};
+    results.push_back(run("startup_parse_differentiate", derivativeNodes, [&] {
+        volatile double sink = Expression<double>::parse(wide).differentiate("x").calculate(x);
+        (void)sink;
+    }));
+    results.push_back(run("startup_load_mapped", derivativeNodes, [&] {
+        MappedExpressions<double> loaded(serializedPath);
+        volatile double sink = loaded.calculate(1, x);
+        (void)sink;
+    }));
+    std::remove(serializedPath.c_str());
+
+    auto base = Expression<double>::parse("sin(x) * exp(x) * x ^ 3 / (1 + x)");
+    for (int order = 1; order <= 4; ++order) {
+        Expression<double> input = base;
+        for (int k = 1; k < order; ++k) {
+            input = input.differentiate("x");
+        }
+        results.push_back(run("differentiate_order_" + std::to_string(order), input.node_count(), [&] {
+            input.differentiate("x");
+        }));
+        results.push_back(run("differentiate_simplified_order_" + std::to_string(order), input.node_count(), [&] {
+            input.differentiate("x", true);
+        }));
+    }
+
+    auto bindingExpr = Expression<double>::parse(vars);
+    std::unordered_map<std::string, double> bindings;
+    for (size_t i = 0; i < 5000; ++i) {
+        bindings[variableName(i)] = 1.0 + static_cast<double>(i % 3) * 1e-3;
+    }
+    results.push_back(run("calculate_large_bindings", bindingExpr.node_count(), [&] {
+        volatile double sink = bindingExpr.calculate(bindings);
+        (void)sink;
+    }));
+
+    // Parameter sweep: one binding changes between evaluations.
+    IncrementalEvaluator<double> incremental(bindingExpr);
+    incremental.calculate(bindings);
+    const size_t sweptSlot = incremental.slot(variableName(4999));
+    double sweptValue = 1.0;
+    results.push_back(run("incremental_one_binding", bindingExpr.node_count(), [&] {
+        sweptValue += 1e-3;
+        incremental.set(sweptSlot, sweptValue);
+        volatile double sink = incremental.evaluate();
+        (void)sink;
+    }));
+
+    evaluationBenchmarks<double>("real", 0.5, results);
+    evaluationBenchmarks<std::complex<double>>("complex", std::complex<double>(0.5, 0.25), results);
+
+    std::printf("%-36s %12s %14s %12s %12s %12s %12s\n", "benchmark", "ns/op", "nodes/sec", "allocs/op",
+                "copies/op", "visits/op", "node kB");
+    for (const BenchResult& r : results) {
+        std::printf("%-36s %12.0f %14.3e %12.1f %12.1f %12.1f %12.0f\n", r.name.c_str(), r.ns_per_op,
+                    r.nodes_per_sec, r.allocations_per_op, r.copies_per_op, r.visits_per_op, r.peak_node_kb);
+    }
+    std::printf("peak RSS: %ld kB\n", peakRssKb());
+
+    if (!jsonPath.empty()) {
+        std::ofstream json(jsonPath);
+        writeJson(json, results);
+    } else {
+        writeJson(std::cout, results);
+    }
+    return 0;
+}
@@ -1,10 +1,17 @@
 #include "expression.hpp"
+#include "compiled_expression.hpp"
+#include "batch_evaluator.hpp"
+#include "expression_serialization.hpp"
+#include "csv_stream.hpp"
+#include <algorithm>
+#include <cstdio>
 #include <iostream>
 #include <unordered_map>
 #include <sstream>
 #include <complex>
 #include <regex>
 #include <stdexcept>
+#include <vector>
 
 bool isComplexNumber(const std::string& str) {
     return str.find('i') != std::string::npos;
@@ -79,9 +86,57 @@ void printResult<std::complex<double>>(const std::complex<double>& result) {
     std::cout << std::endl;
 }
 
+template <typename T>
+void printDerivative(Expression<T> expr, const std::string& varName, bool simplify, const std::string& savePath) {
+    auto derivative = expr.differentiate(varName);
+    std::cout << "Expression: " << expr.to_string() << std::endl;
+    if (simplify) {
+        typename Expression<T>::SimplifyReport report;
+        derivative = derivative.simplify(&report);
+        std::cout << "Derivative: " << derivative.to_string() << std::endl;
+        std::cout << "Nodes: " << report.nodes_before << " -> " << report.nodes_after << std::endl;
+    } else {
+        std::cout << "Derivative: " << derivative.to_string() << std::endl;
+    }
+    if (!savePath.empty()) {
+        save_expressions<T>(savePath, {{"f", expr}, {"d/d" + varName, derivative}});
+    }
+}
+
+template <typename T>
+void printLoaded(const std::string& path, const std::unordered_map<std::string, T>& variables, bool evaluate) {
+    MappedExpressions<T> loaded(path);
+    for (size_t root = 0; root < loaded.root_count(); ++root) {
+        std::cout << loaded.label(root) << ": " << loaded.expression(root).to_string() << std::endl;
+        if (evaluate) {
+            T value = loaded.calculate(root, variables);
+            std::cout << loaded.label(root) << " = ";
+            printResult(value);
+        }
+    }
+}
+
+template <typename T>
+void printGradient(const std::string& expressionStr, const std::unordered_map<std::string, T>& variables,
+                   const std::string& skip) {
+    CompiledExpression<T> program(Expression<T>::parse(expressionStr));
+    Gradient<T> gradient = program.gradient(variables);
+    std::cout << "Value: ";
+    printResult(gradient.value);
+    for (const std::string& name : program.variables()) {
+        if (name == skip) {
+            continue;
+        }
+        std::cout << "d/d" << name << ": ";
+        printResult(gradient.partials.at(name));
+    }
+}
+
 int main(int argc, char* argv[]) {
     if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " --eval <expression> [variables] OR --diff <expression> --by <variable>" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " --eval <expression> [variables] OR --diff <expression> --by <variable> [--simplify]"
+                  << " OR --grad <expression> [variables] OR --eval-stream <expression> [--complex] [file.csv]"
+                  << " OR --load <file> [variables]" << std::endl;
         return 1;
     }
 
@@ -127,13 +182,55 @@ int main(int argc, char* argv[]) {
         }
 
     } else if (mode == "--diff") {
+        const std::string usage =
+            std::string("Usage: ") + argv[0] + " --diff <expression> --by <variable> [--simplify] [--save <file>]";
         if (argc < 5 || std::string(argv[3]) != "--by") {
-            std::cerr << "Usage: " << argv[0] << " --diff <expression> --by <variable>" << std::endl;
+            std::cerr << usage << std::endl;
             return 1;
         }
 
         std::string expressionStr = argv[2];
         std::string varName = argv[4];
+        try {
+            bool isComplex = false;
+            bool simplify = false;
+            std::string savePath;
+            for (int i = 3; i < argc; ++i) {
+                std::string arg = argv[i];
+                if (arg == "--simplify") {
+                    simplify = true;
+                    continue;
+                }
+                if (arg == "--save") {
+                    if (i + 1 >= argc) {
+                        std::cerr << usage << std::endl;
+                        return 1;
+                    }
+                    savePath = argv[++i];
+                    continue;
+                }
+                if (isComplexNumber(arg.substr(arg.find('=') + 1))) {
+                    isComplex = true;
+                }
+            }
+
+            if (isComplex) {
+                printDerivative(Expression<std::complex<double>>::parse(expressionStr), varName, simplify, savePath);
+            } else {
+                printDerivative(Expression<double>::parse(expressionStr), varName, simplify, savePath);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+
+    } else if (mode == "--grad") {
+        if (argc < 3) {
+            std::cerr << "Usage: " << argv[0] << " --grad <expression> [variables]" << std::endl;
+            return 1;
+        }
+
+        std::string expressionStr = argv[2];
         try {
             bool isComplex = false;
             for (int i = 3; i < argc; ++i) {
@@ -145,21 +242,97 @@ int main(int argc, char* argv[]) {
             }
 
             if (isComplex) {
-                auto expr = Expression<std::complex<double>>::parse(expressionStr);
-                auto derivative = expr.differentiate(varName);
-                std::cout << "Expression: " << expr.to_string() << std::endl;
-                std::cout << "Derivative: " << derivative.to_string() << std::endl;
+                std::unordered_map<std::string, std::complex<double>> variables;
+                for (int i = 3; i < argc; ++i) {
+                    parseVariable(argv[i], variables);
+                }
+                std::string skip = variables.count("i") ? "" : "i";
+                variables["i"] = std::complex<double>(0.0, 1.0);
+                printGradient(expressionStr, variables, skip);
             } else {
-                auto expr = Expression<double>::parse(expressionStr);
-                auto derivative = expr.differentiate(varName);
-                std::cout << "Expression: " << expr.to_string() << std::endl;
-                std::cout << "Derivative: " << derivative.to_string() << std::endl;
+                std::unordered_map<std::string, double> variables;
+                for (int i = 3; i < argc; ++i) {
+                    parseVariable(argv[i], variables);
+                }
+                printGradient(expressionStr, variables, "");
             }
         } catch (const std::exception& e) {
             std::cerr << "Error: " << e.what() << std::endl;
             return 1;
         }
 
+    } else if (mode == "--load") {
+        if (argc < 3) {
+            std::cerr << "Usage: " << argv[0] << " --load <file> [variables]" << std::endl;
+            return 1;
+        }
+
+        std::string path = argv[2];
+        try {
+            if (serialized::is_complex(path)) {
+                std::unordered_map<std::string, std::complex<double>> variables;
+                for (int i = 3; i < argc; ++i) {
+                    parseVariable(argv[i], variables);
+                }
+                variables["i"] = std::complex<double>(0.0, 1.0);
+                printLoaded(path, variables, argc > 3);
+            } else {
+                std::unordered_map<std::string, double> variables;
+                for (int i = 3; i < argc; ++i) {
+                    parseVariable(argv[i], variables);
+                }
+                printLoaded(path, variables, argc > 3);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+
+    } else if (mode == "--eval-stream") {
+        const std::string usage = std::string("Usage: ") + argv[0] +
+                                  " --eval-stream <expression> [--complex] [file.csv]\n"
+                                  "Values are real unless the first data row holds a complex one; "
+                                  "--complex evaluates every row as complex.";
+        if (argc < 3) {
+            std::cerr << usage << std::endl;
+            return 1;
+        }
+
+        std::string expressionStr = argv[2];
+        bool forceComplex = false;
+        const char* path = nullptr;
+        for (int i = 3; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--complex") {
+                forceComplex = true;
+            } else if (!path) {
+                path = argv[i];
+            } else {
+                std::cerr << usage << std::endl;
+                return 1;
+            }
+        }
+        std::FILE* input = stdin;
+        if (path && std::string(path) != "-") {
+            input = std::fopen(path, "rb");
+            if (!input) {
+                std::cerr << "Error: cannot open " << path << std::endl;
+                return 1;
+            }
+        }
+        try {
+            evaluateCsvStream(expressionStr, input, stdout, forceComplex);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            if (input != stdin) {
+                std::fclose(input);
+            }
+            return 1;
+        }
+        if (input != stdin) {
+            std::fclose(input);
+        }
+
     } else {
         std::cerr << "Unknown mode: " << mode << std::endl;
         return 1;
@@ -1,7 +1,23 @@
 #include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
 #include "expression.hpp"
+#include "compiled_expression.hpp"
+#include "batch_evaluator.hpp"
+#include "parallel_evaluator.hpp"
+#include "static_expression.hpp"
+#include "expression_serialization.hpp"
+#include "incremental_evaluator.hpp"
+#include "csv_stream.hpp"
+
+// Constructed before the node table and assigned a tree later, so it is
+// released after every other static at exit.
+Expression<double> exit_tree(0.0);
 
 void symbol() {
     Expression<int> number = Expression<int>("x");
@@ -78,6 +94,560 @@ void my_exp() {
     std::cout << "Exp test: OK" << std::endl;
 }
 
+void compiled() {
+    auto expr = Expression<double>::parse("x * sin(y) + ln(x) / (y - 1) ^ 2 - exp(x / y)");
+    CompiledExpression<double> program(expr);
+    std::unordered_map<std::string, double> vars{{"x", 1.5}, {"y", 3.0}};
+    double values[2];
+    values[program.slot("x")] = 1.5;
+    values[program.slot("y")] = 3.0;
+    assert(program.variable_count() == 2);
+    assert(program.evaluate(values) == expr.calculate(vars));
+    assert(program.calculate(vars) == expr.calculate(vars));
+
+    auto division = Expression<double>::parse("ln(x) / (y - 3)");
+    CompiledExpression<double> divisionProgram(division);
+    std::string expected;
+    try {
+        division.calculate(vars);
+    } catch (const std::exception& e) {
+        expected = e.what();
+    }
+    try {
+        divisionProgram.calculate(vars);
+        assert(false);
+    } catch (const std::exception& e) {
+        assert(expected == e.what());
+    }
+
+    vars["x"] = 0;
+    try {
+        CompiledExpression<double>(Expression<double>::parse("ln(x)")).calculate(vars);
+        assert(false);
+    } catch (const std::exception& e) {
+        assert(std::string(e.what()) == "Logarithm of non-positive number");
+    }
+
+    auto complexExpr = Expression<std::complex<double>>::parse("z * z + ln(z)");
+    std::unordered_map<std::string, std::complex<double>> complexVars{{"z", {1.0, 2.0}}};
+    CompiledExpression<std::complex<double>> complexProgram(complexExpr);
+    assert(complexProgram.calculate(complexVars) == complexExpr.calculate(complexVars));
+    std::cout << "Compiled test: OK" << std::endl;
+}
+
+void batch() {
+    auto expr = Expression<double>::parse("x * sin(y) + ln(x) / (y - 1) ^ 2 - exp(x / y)");
+    CompiledExpression<double> program(expr);
+    BatchEvaluator<double> evaluator(program);
+    const size_t rows = 1000;
+    std::vector<double> xs(rows), ys(rows), out(rows);
+    std::vector<RowError> errors(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        xs[i] = static_cast<double>(i % 7) - 1.0;
+        ys[i] = static_cast<double>(i % 5) * 0.5;
+    }
+    std::unordered_map<std::string, const double*> columns{{"x", xs.data()}, {"y", ys.data()}};
+    evaluator.evaluate(columns, rows, out.data(), errors.data());
+    for (size_t i = 0; i < rows; ++i) {
+        std::unordered_map<std::string, double> vars{{"x", xs[i]}, {"y", ys[i]}};
+        try {
+            double expected = expr.calculate(vars);
+            assert(errors[i] == RowError::None);
+            assert(out[i] == expected || (std::isnan(out[i]) && std::isnan(expected)));
+        } catch (const std::exception& e) {
+            assert(std::isnan(out[i]));
+            assert(std::string(BatchEvaluator<double>::error_message(errors[i])) == e.what());
+        }
+    }
+
+    auto complexExpr = Expression<std::complex<double>>::parse("z * z / (z - 1) + ln(z)");
+    BatchEvaluator<std::complex<double>> complexEvaluator((CompiledExpression<std::complex<double>>(complexExpr)));
+    std::vector<std::complex<double>> zs{{1.0, 0.0}, {0.0, 0.0}, {2.0, -1.0}}, complexOut(3);
+    std::vector<RowError> complexErrors(3);
+    const std::complex<double>* complexColumns[] = {zs.data()};
+    complexEvaluator.evaluate(complexColumns, zs.size(), complexOut.data(), complexErrors.data());
+    std::unordered_map<std::string, std::complex<double>> complexVars{{"z", zs[2]}};
+    assert(complexErrors[0] == RowError::DivisionByZero);
+    assert(complexErrors[1] == RowError::LogarithmDomain);
+    assert(complexErrors[2] == RowError::None);
+    assert(complexOut[2] == complexExpr.calculate(complexVars));
+    std::cout << "Batch test: OK" << std::endl;
+}
+
+void sharing() {
+    // Shared nodes are immutable through the expression's children.
+    static_assert(std::is_const_v<std::remove_reference_t<decltype(*Expression<double>(1.0).node_left)>>);
+    auto expr = Expression<double>::parse("sin(x * y) + sin(x * y)");
+    assert(expr.node_left.get() == expr.node_right.get());
+
+    auto other = Expression<double>::parse("cos(x * y)");
+    assert(other.node_left.get() == expr.node_left->node_left.get());
+
+    auto derivative = (Expression<double>("x") * Expression<double>("x").sin()).differentiate("x");
+    auto again = (Expression<double>("x") * Expression<double>("x").sin()).differentiate("x");
+    assert(derivative.node_left.get() == again.node_left.get());
+    assert(derivative.to_string() == "((1.000000 * sin(x)) + (x * (cos(x) * 1.000000)))");
+
+    std::unordered_map<std::string, double> vars{{"x", 0.5}, {"y", 2.0}};
+    assert(expr.calculate(vars) == 2 * std::sin(1.0));
+    CompiledExpression<double> program(expr);
+    assert(program.register_count() == 5);
+    assert(program.calculate(vars) == expr.calculate(vars));
+    std::cout << "Sharing test: OK" << std::endl;
+}
+
+void allocations() {
+    std::string sum = "x";
+    std::string product = "x";
+    for (int i = 0; i < 500; ++i) {
+        sum += " + x * " + std::to_string(i);
+        product += " * x";
+    }
+
+    Expression<double>::reset_allocation_stats();
+    auto expr = Expression<double>::parse(sum);
+    auto stats = Expression<double>::allocation_stats();
+    assert(stats.nodes_allocated <= 4 * 500);
+    exit_tree = expr;
+
+    auto power = Expression<double>::parse(product);
+    Expression<double>::reset_allocation_stats();
+    auto derivative = power.differentiate("x");
+    stats = Expression<double>::allocation_stats();
+    assert(stats.nodes_allocated <= 4 * 500);
+
+    auto squared = power * power;
+    auto nested = squared * squared;
+    Expression<double>::reset_allocation_stats();
+    auto nestedDerivative = nested.differentiate("x");
+    assert(Expression<double>::allocation_stats().nodes_allocated <= 2 * 4 * 500);
+
+    std::unordered_map<std::string, double> vars{{"x", 1.0}};
+    assert(derivative.calculate(vars) == 501);
+    assert(nestedDerivative.calculate(vars) == 4 * 501);
+
+    // Chunks go back once all of their nodes are released; one empty chunk
+    // may be kept as a spare.
+    const size_t reserved = Expression<double>::allocation_stats().arena_bytes;
+    {
+        std::string large = "y";
+        for (int i = 0; i < 20000; ++i) {
+            large += " + y * " + std::to_string(i + 1000);
+        }
+        auto temporary = Expression<double>::parse(large);
+        assert(Expression<double>::allocation_stats().arena_bytes > reserved + 1024 * 1024);
+    }
+    assert(Expression<double>::allocation_stats().arena_bytes <= reserved + 64 * 1024);
+    assert(Expression<double>::allocation_stats().peak_arena_bytes > reserved + 1024 * 1024);
+    Expression<double>::reset_allocation_stats();
+    assert(Expression<double>::allocation_stats().peak_arena_bytes ==
+           Expression<double>::allocation_stats().arena_bytes);
+    std::cout << "Allocation test: OK" << std::endl;
+}
+
+void simplification() {
+    auto square = Expression<double>::parse("x ^ 2");
+    Expression<double>::SimplifyReport report;
+    auto derivative = square.differentiate("x").simplify(&report);
+    assert(derivative.to_string() == "(2.000000 * x)");
+    assert(report.nodes_before == 11 && report.nodes_after == 3);
+
+    assert(Expression<double>::parse("0 * cos(x) + 1 * y - 0").simplify().to_string() == "y");
+    assert(Expression<double>::parse("-(-x)").simplify().to_string() == "x");
+    assert(Expression<double>::parse("2 * 3 + x ^ 1").simplify().to_string() == "(6.000000 + x)");
+    assert(Expression<double>::parse("1 / 0").simplify().to_string() == "(1.000000 / 0.000000)");
+
+    auto expr = Expression<double>::parse("sin(x) * x ^ 3 / (y + 1)");
+    auto full = expr.differentiate("x");
+    auto simplified = expr.differentiate("x", true);
+    assert(simplified.node_count() < full.node_count());
+    std::unordered_map<std::string, double> vars{{"x", 0.7}, {"y", 2.0}};
+    assert(std::abs(simplified.calculate(vars) - full.calculate(vars)) < 1e-12);
+    std::cout << "Simplify test: OK" << std::endl;
+}
+
+void gradient() {
+    auto expr = Expression<double>::parse("x * sin(y) + ln(x) / (y - 1) ^ 2 - exp(x / y) + x ^ y");
+    CompiledExpression<double> program(expr);
+    std::unordered_map<std::string, double> vars{{"x", 1.5}, {"y", 3.0}};
+    Gradient<double> result = program.gradient(vars);
+    assert(result.value == expr.calculate(vars));
+    for (const char* name : {"x", "y"}) {
+        double expected = expr.differentiate(name).calculate(vars);
+        assert(std::abs(result.partials.at(name) - expected) < 1e-12 * std::max(1.0, std::abs(expected)));
+    }
+
+    auto square = Expression<double>::parse("x ^ 2");
+    vars["x"] = -2.0;
+    assert(CompiledExpression<double>(square).gradient(vars).partials.at("x") == -4.0);
+
+    auto complexExpr = Expression<std::complex<double>>::parse("z * w + sin(z) / w + ln(w)");
+    std::unordered_map<std::string, std::complex<double>> complexVars{{"z", {1.0, 2.0}}, {"w", {0.5, -1.0}}};
+    Gradient<std::complex<double>> complexResult = CompiledExpression<std::complex<double>>(complexExpr).gradient(complexVars);
+    for (const char* name : {"z", "w"}) {
+        std::complex<double> expected = complexExpr.differentiate(name).calculate(complexVars);
+        assert(std::abs(complexResult.partials.at(name) - expected) < 1e-12);
+    }
+    std::cout << "Gradient test: OK" << std::endl;
+}
+
+void parallel() {
+    auto expr = Expression<double>::parse("x * sin(y) + ln(x) / (y - 1) ^ 2 - exp(x / y)");
+    CompiledExpression<double> program(expr);
+    ThreadPool pool(4);
+    ParallelEvaluator<double> evaluator(program, pool, 1000);
+    const size_t rows = 100000;
+    std::vector<double> xs(rows), ys(rows), out(rows), expected(rows);
+    std::vector<RowError> errors(rows), expectedErrors(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        xs[i] = static_cast<double>(i % 13) - 2.0;
+        ys[i] = static_cast<double>(i % 11) * 0.25;
+    }
+    const double* columns[2];
+    columns[program.slot("x")] = xs.data();
+    columns[program.slot("y")] = ys.data();
+    evaluator.evaluate(columns, rows, out.data(), errors.data());
+    BatchEvaluator<double>(program).evaluate(columns, rows, expected.data(), expectedErrors.data());
+    for (size_t i = 0; i < rows; ++i) {
+        assert(errors[i] == expectedErrors[i]);
+        assert(out[i] == expected[i] || (std::isnan(out[i]) && std::isnan(expected[i])));
+    }
+
+    std::vector<CompiledExpression<double>> derivatives;
+    for (const char* name : {"x", "y", "z"}) {
+        derivatives.emplace_back(expr.differentiate(name));
+    }
+    derivatives.emplace_back(Expression<double>::parse("1 / (x - 2)"));
+    std::unordered_map<std::string, double> vars{{"x", 2.0}, {"y", 3.0}};
+    std::vector<std::string> messages;
+    std::vector<double> values = evaluate_all(derivatives, vars, pool, &messages);
+    assert(values[0] == expr.differentiate("x").calculate(vars));
+    assert(values[1] == expr.differentiate("y").calculate(vars));
+    assert(values[2] == 0 && messages[2].empty());
+    assert(std::isnan(values[3]) && messages[3] == "Division by zero");
+
+    // Workers also build and drop expressions whose nodes are interned
+    // together with the long-lived one above.
+    const std::string text = expr.to_string();
+    std::vector<double> slopes(64), compiledSlopes(64);
+    pool.parallel_for(slopes.size(), [&](size_t i, size_t) {
+        auto derivative = Expression<double>::parse(text).differentiate("x");
+        slopes[i] = derivative.calculate(vars);
+        compiledSlopes[i] = CompiledExpression<double>(derivative).calculate(vars);
+    });
+    for (size_t i = 0; i < slopes.size(); ++i) {
+        assert(slopes[i] == expr.differentiate("x").calculate(vars));
+        assert(compiledSlopes[i] == values[0]);
+    }
+    std::cout << "Parallel test: OK" << std::endl;
+}
+
+void static_expression() {
+    constexpr static_expr::Var<'x'> x;
+    constexpr static_expr::Var<'y'> y;
+    static_assert(static_expr::evaluate<double>(x * x + 2.0 * y - 1, x = 3.0, y = 0.5) == 9.0);
+
+    auto f = x * sin(y) + ln(x) / ((y - 1) ^ 2) - exp(x / y) + (x ^ y);
+    auto runtime = static_expr::to_expression<double>(f);
+    assert(runtime.to_string() ==
+           Expression<double>::parse("x * sin(y) + ln(x) / (y - 1) ^ 2 - exp(x / y) + x ^ y").to_string());
+
+    std::unordered_map<std::string, double> vars{{"x", 1.5}, {"y", 3.0}};
+    assert(static_expr::evaluate<double>(f, x = 1.5, y = 3.0) == runtime.calculate(vars));
+
+    auto dfdx = static_expr::derivative<decltype(x)>(f);
+    assert(static_expr::to_expression<double>(dfdx).to_string() == runtime.differentiate("x").to_string());
+    assert(static_expr::evaluate<double>(dfdx, y = 3.0, x = 1.5) == runtime.differentiate("x").calculate(vars));
+    auto dfdy = static_expr::derivative<decltype(y)>(cos(f));
+    assert(static_expr::to_expression<double>(dfdy).to_string() == runtime.cos().differentiate("y").to_string());
+
+    try {
+        static_expr::evaluate<double>(ln(x) / (y - 3), x = -1.0, y = 3.0);
+        assert(false);
+    } catch (const std::exception& e) {
+        assert(std::string(e.what()) == "Division by zero");
+    }
+
+    constexpr static_expr::Var<'z'> z;
+    auto g = z * z + ln(z);
+    std::unordered_map<std::string, std::complex<double>> complexVars{{"z", {1.0, 2.0}}};
+    assert(static_expr::evaluate<std::complex<double>>(g, z = std::complex<double>(1.0, 2.0)) ==
+           static_expr::to_expression<std::complex<double>>(g).calculate(complexVars));
+    std::cout << "Static expression test: OK" << std::endl;
+}
+
+void parsing() {
+    assert(Expression<double>::parse("-x^2").to_string() == "((0.000000 - x) ^ 2.000000)");
+    assert(Expression<double>::parse("2^-3^2").to_string() == "((2.000000 ^ (0.000000 - 3.000000)) ^ 2.000000)");
+    assert(Expression<double>::parse("2 * -x ^ 2").to_string() == "(2.000000 * ((0.000000 - x) ^ 2.000000))");
+    assert(Expression<double>::parse("a / b / c - d - e").to_string() == "((((a / b) / c) - d) - e)");
+    assert(Expression<double>::parse("ln (x) + exp(-.5)").to_string() == "(ln(x) + exp((0.000000 - 0.500000)))");
+
+    const char* invalid[][2] = {
+        {"x + * y", "Unexpected character '*' at offset 4"},
+        {"(x + 1", "Expected ')' at offset 0"},
+        {"x + 1)", "Unexpected ')' at offset 5"},
+        {"sin x", "Expected '(' after 'sin' at offset 4"},
+        {"1.2.3", "Invalid number '1.2.3' at offset 0"},
+        {"x y", "Unexpected character 'y' at offset 2"},
+        {"2 *", "Unexpected end of expression at offset 3"},
+        {"x + \xc3\xa9", "Unexpected character '\xc3' at offset 4"},
+    };
+    for (const auto& [text, message] : invalid) {
+        try {
+            Expression<double>::parse(text);
+            assert(false);
+        } catch (const std::exception& e) {
+            assert(std::string(e.what()) == message);
+        }
+    }
+
+    // Neither parsing nor releasing the tree recurses per nesting level.
+    const size_t depth = 200000;
+    std::string nested = std::string(depth, '(') + "x" + std::string(depth, ')');
+    for (size_t i = 0; i < depth; ++i) {
+        nested += " + " + std::string(i % 3 ? "x" : "sin(x)");
+    }
+    auto large = Expression<double>::parse(nested);
+    CompiledExpression<double> program(large);
+    double x = 0.5;
+    const double sum = 0.5 + 66667 * std::sin(0.5) + 133333 * 0.5;
+    assert(std::abs(program.evaluate(&x) - sum) < 1e-6);
+
+    // The tree itself can be evaluated, differentiated, simplified and
+    // printed at that depth as well.
+    std::unordered_map<std::string, double> at{{"x", x}};
+    assert(std::abs(large.calculate(at) - sum) < 1e-6);
+    auto slope = large.differentiate("x", true);
+    assert(std::abs(slope.calculate(at) - (1 + 66667 * std::cos(0.5) + 133333)) < 1e-6);
+    assert(large.to_string().size() == 2 * depth + 1 + 66667 * std::string(" + sin(x)").size() + 133333 * 4);
+    std::cout << "Parsing test: OK" << std::endl;
+}
+
+void concurrent_teardown() {
+    // Hash-consing shares nodes between unrelated expressions, so threads
+    // that build and drop the same formula tear down each other's nodes.
+    const char* formula = "x * sin(y) + ln(x) / (y - 1) ^ 2 - exp(x / y) + x ^ y";
+    std::unordered_map<std::string, double> vars{{"x", 1.5}, {"y", 3.0}};
+    const auto reference = Expression<double>::parse(formula);
+    const double value = reference.calculate(vars);
+    const double slope = reference.differentiate("x").calculate(vars);
+    const double simplified = reference.differentiate("x", true).calculate(vars);
+
+    std::vector<std::thread> threads;
+    std::vector<int> ok(4, 1);
+    for (size_t t = 0; t < ok.size(); ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < 500; ++i) {
+                auto expr = Expression<double>::parse(formula);
+                auto derivative = expr.differentiate("x");
+                auto copy = derivative.simplify();
+                ok[t] &= expr.calculate(vars) == value && derivative.calculate(vars) == slope &&
+                         copy.calculate(vars) == simplified;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (int result : ok) {
+        assert(result);
+    }
+    std::cout << "Concurrent teardown test: OK" << std::endl;
+}
+
+void serialization() {
+    const std::string path = "serialization_test.bin";
+    auto f = Expression<double>::parse("x * sin(y) + ln(x) / (y - 1) ^ 2 - exp(x / y)");
+    auto dfdx = f.differentiate("x");
+    auto dfdy = f.differentiate("y");
+    save_expressions<double>(path, {{"f", f}, {"d/dx", dfdx}, {"d/dy", dfdy}, {"g", Expression<double>("z")}});
+    assert(!serialized::is_complex(path));
+
+    {
+        MappedExpressions<double> loaded(path);
+        assert(loaded.root_count() == 4);
+        assert(loaded.root("d/dy") == 2 && loaded.label(1) == "d/dx");
+        assert(loaded.variable_count() == 3 && loaded.variable(loaded.slot("y")) == "y");
+        // Nodes shared between the function and its derivatives are stored once.
+        assert(loaded.node_count() < f.node_count() + dfdx.node_count() + dfdy.node_count());
+
+        const Expression<double> originals[] = {f, dfdx, dfdy};
+        for (size_t root = 0; root < 3; ++root) {
+            assert(loaded.expression(root).to_string() == originals[root].to_string());
+            for (auto [x, y] : {std::pair{1.5, 3.0}, std::pair{1.5, 1.0}, std::pair{-1.0, 1.0}, std::pair{2.0, -2.5}}) {
+                std::unordered_map<std::string, double> vars{{"x", x}, {"y", y}};
+                std::string expected, actual;
+                double expectedValue = 0, actualValue = 0;
+                try {
+                    expectedValue = originals[root].calculate(vars);
+                } catch (const std::exception& e) {
+                    expected = e.what();
+                }
+                try {
+                    actualValue = loaded.calculate(root, vars);
+                } catch (const std::exception& e) {
+                    actual = e.what();
+                }
+                assert(expected == actual && expectedValue == actualValue);
+            }
+        }
+
+        std::unordered_map<std::string, double> vars{{"x", 1.5}, {"y", 3.0}};
+        assert(loaded.calculate(0, vars) == f.calculate(vars));
+        try {
+            loaded.calculate(loaded.root("g"), vars);
+            assert(false);
+        } catch (const std::exception& e) {
+            assert(std::string(e.what()) == "Variable not found: z");
+        }
+        try {
+            MappedExpressions<std::complex<double>> wrongType(path);
+            assert(false);
+        } catch (const std::exception& e) {
+            assert(std::string(e.what()) == "Serialized expressions hold a different value type");
+        }
+    }
+
+    std::string data = serialize_expressions<double>({{"f", f}});
+    std::ofstream(path, std::ios::binary).write(data.data(), data.size() - 1);
+    try {
+        MappedExpressions<double> truncated(path);
+        assert(false);
+    } catch (const std::exception& e) {
+        assert(std::string(e.what()) == "Serialized expression file is truncated or corrupt");
+    }
+
+    auto z = Expression<std::complex<double>>::parse("z * z + ln(z) / w");
+    save_expressions<std::complex<double>>(path, {{"f", z}, {"d/dz", z.differentiate("z")}});
+    assert(serialized::is_complex(path));
+    MappedExpressions<std::complex<double>> complexLoaded(path);
+    std::unordered_map<std::string, std::complex<double>> complexVars{{"z", {1.0, 2.0}}, {"w", {0.5, -1.0}}};
+    assert(complexLoaded.expression(1).to_string() == z.differentiate("z").to_string());
+    assert(complexLoaded.calculate(0, complexVars) == z.calculate(complexVars));
+    assert(complexLoaded.calculate(1, complexVars) == z.differentiate("z").calculate(complexVars));
+    std::remove(path.c_str());
+    std::cout << "Serialization test: OK" << std::endl;
+}
+
+void incremental() {
+    auto expr = Expression<double>::parse("sin(a) * b + ln(c) / (d - 1) + a ^ 2 - exp(b / c)");
+    IncrementalEvaluator<double> evaluator(expr);
+    std::unordered_map<std::string, double> vars{{"a", 0.5}, {"b", 2.0}, {"c", 3.0}, {"d", 4.0}};
+    assert(evaluator.calculate(vars) == expr.calculate(vars));
+    assert(evaluator.recomputed_count() == evaluator.node_count());
+
+    // Only a -> sin(a), a ^ 2 and the sums above them are recomputed.
+    vars["a"] = 0.75;
+    evaluator.set("a", 0.75);
+    assert(evaluator.evaluate() == expr.calculate(vars));
+    assert(evaluator.recomputed_count() > 0 && evaluator.recomputed_count() < evaluator.node_count() / 2);
+
+    evaluator.set("c", 3.0);
+    assert(evaluator.evaluate() == expr.calculate(vars));
+    assert(evaluator.recomputed_count() == 0);
+
+    // A division by zero is reported like calculate(); the next update
+    // recovers with a full evaluation.
+    evaluator.set("d", 1.0);
+    try {
+        evaluator.evaluate();
+        assert(false);
+    } catch (const std::exception& e) {
+        assert(std::string(e.what()) == "Division by zero");
+    }
+    vars["d"] = -0.0;
+    evaluator.set("d", -0.0);
+    assert(evaluator.evaluate() == expr.calculate(vars));
+    assert(evaluator.recomputed_count() == evaluator.node_count());
+
+    // In a long left-deep sum, the last term's variable sits just below the root.
+    std::string sum = "x";
+    for (int i = 0; i < 200; ++i) {
+        sum += " + sin(" + std::string{'v', char('a' + i % 26), char('a' + i / 26)} + ") * x";
+    }
+    auto large = Expression<double>::parse(sum);
+    IncrementalEvaluator<double> sweep(large);
+    std::unordered_map<std::string, double> sweepVars;
+    for (const std::string& name : sweep.variables()) {
+        sweepVars[name] = 0.25;
+    }
+    sweep.calculate(sweepVars);
+    for (double step : {0.5, 0.75, 1.0}) {
+        sweepVars["vrh"] = step;
+        sweep.set("vrh", step);
+        assert(sweep.evaluate() == large.calculate(sweepVars));
+        assert(sweep.recomputed_count() == 4);
+    }
+    sweepVars["x"] = 2.0;
+    sweep.set("x", 2.0);
+    assert(sweep.evaluate() == large.calculate(sweepVars));
+
+    auto complexExpr = Expression<std::complex<double>>::parse("z * w + ln(z) / (w - 1)");
+    IncrementalEvaluator<std::complex<double>> complexEvaluator(complexExpr);
+    std::unordered_map<std::string, std::complex<double>> complexVars{{"z", {1.0, 2.0}}, {"w", {0.5, -1.0}}};
+    complexEvaluator.calculate(complexVars);
+    complexVars["w"] = {2.0, 0.5};
+    complexEvaluator.set("w", complexVars["w"]);
+    std::complex<double> incrementalValue = complexEvaluator.evaluate();
+    std::complex<double> fullValue = complexExpr.calculate(complexVars);
+    assert(std::memcmp(&incrementalValue, &fullValue, sizeof(fullValue)) == 0);
+    std::cout << "Incremental test: OK" << std::endl;
+}
+
+std::string runStream(const std::string& expression, const std::string& csv, bool forceComplex = false) {
+    std::FILE* input = std::tmpfile();
+    std::FILE* output = std::tmpfile();
+    std::fputs(csv.c_str(), input);
+    std::rewind(input);
+    evaluateCsvStream(expression, input, output, forceComplex);
+    std::rewind(output);
+    std::string result;
+    char buffer[256];
+    size_t read;
+    while ((read = std::fread(buffer, 1, sizeof(buffer), output)) > 0) {
+        result.append(buffer, read);
+    }
+    std::fclose(input);
+    std::fclose(output);
+    return result;
+}
+
+void csv_stream() {
+    std::complex<double> c;
+    assert(parseFastComplex("1.5+2i", c) && c == std::complex<double>(1.5, 2.0));
+    assert(parseFastComplex("3-0.5i", c) && c == std::complex<double>(3.0, -0.5));
+    assert(parseFastComplex("-i", c) && c == std::complex<double>(0.0, -1.0));
+    assert(parseFastComplex("1e-5i", c) && c == std::complex<double>(0.0, 1e-5));
+    assert(parseFastComplex("2e+3-4i", c) && c == std::complex<double>(2000.0, -4.0));
+    assert(!parseFastComplex("1+2j", c) && !parseFastComplex("", c));
+    double d;
+    assert(parseFastReal("+2.5", d) && d == 2.5);
+    assert(parseFastReal("inf", d) && std::isinf(d));
+    assert(!parseFastReal("1i", d) && !parseFastReal("1,5", d));
+
+    std::vector<std::string_view> fields = splitFields(" x , y,");
+    assert(fields.size() == 3 && fields[0] == "x" && fields[1] == "y" && fields[2].empty());
+
+    // Rows are checked against the header width; bad rows keep the run going.
+    assert(runStream("x / y", "x,y\n1,2\n1,2,3\n1\n1,2,3,4\n3,0\n1,abc\n") ==
+           "result,error\n0.5,\n,Expected 2 values\n,Expected 2 values\n,Expected 2 values\n"
+           ",Division by zero\n,Invalid number: abc\n");
+    assert(runStream("x * 2", "x,y\r\n1,2\r\n\r\n3,4\r\n") == "result,error\n2,\n6,\n");
+
+    // Unused columns and "inf" do not switch to complex mode.
+    assert(runStream("x * 2", "x,y\ninf,1+i\n") == "result,error\ninf,\n");
+    assert(runStream("x * 2", "x,y\n1+i,0\n2,0\n") == "result,error\n2+2i,\n4,\n");
+    // Without an "i" column, i is the imaginary unit.
+    assert(runStream("x * i", "x\n2\n") == "result,error\n0+2i,\n");
+    assert(runStream("x * i", "x,i\n2,3\n") == "result,error\n6,\n");
+    assert(runStream("x", "x\n") == "result,error\n");
+    // The mode follows the first row unless complex evaluation is forced.
+    assert(runStream("x * 2", "x\n1\n1+2i\n") == "result,error\n2,\n,Invalid number: 1+2i\n");
+    assert(runStream("x * 2", "x\n1\n1+2i\n", true) == "result,error\n2,\n2+4i,\n");
+    std::cout << "CSV stream test: OK" << std::endl;
+}
+
 int main() {
     symbol();
     addition();
@@ -89,6 +659,19 @@ int main() {
     my_cos();
     my_ln();
     my_exp();
+    compiled();
+    batch();
+    sharing();
+    allocations();
+    simplification();
+    gradient();
+    parallel();
+    static_expression();
+    parsing();
+    concurrent_teardown();
+    serialization();
+    incremental();
+    csv_stream();
     std::cout << "All tests passed!" << std::endl;
 
     try {
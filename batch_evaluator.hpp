@@ -0,0 +1,64 @@
+#ifndef BATCH_EVALUATOR_HPP
+#define BATCH_EVALUATOR_HPP
+
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "compiled_expression.hpp"
+
+// Per-row outcome of a batched evaluation. A row that fails keeps the first
+// error in calculate() order and its output is set to NaN.
+enum class RowError : std::uint8_t { None = 0, DivisionByZero = 1, LogarithmDomain = 2 };
+
+// Evaluates a compiled expression over columns of variable values
+// (structure-of-arrays). Rows are processed in blocks and every instruction
+// runs as a tight loop over the block, so the arithmetic kernels vectorize.
+template <typename T>
+class BatchEvaluator {
+    static_assert(!std::is_integral_v<T>, "BatchEvaluator requires a floating-point or complex type");
+
+public:
+    static constexpr size_t block_size = 256;
+
+    // Scratch memory for one evaluating thread.
+    struct Workspace {
+        std::vector<T> buffers;
+        std::vector<const T*> operands;
+        std::vector<std::uint8_t> errors;
+    };
+
+    explicit BatchEvaluator(const CompiledExpression<T>& program);
+
+    const std::vector<std::string>& variables() const;
+    Workspace make_workspace() const;
+
+    // columns[slot] points at `rows` values of variables()[slot]. errors may be
+    // null; otherwise it receives one RowError per row.
+    void evaluate(const T* const* columns, size_t rows, T* out, RowError* errors = nullptr);
+    void evaluate(const T* const* columns, size_t rows, T* out, RowError* errors, Workspace& workspace) const;
+    void evaluate(const std::unordered_map<std::string, const T*>& columns, size_t rows, T* out,
+                  RowError* errors = nullptr);
+
+    static T invalid_value();
+    static const char* error_message(RowError error);
+
+private:
+    using OpCode = typename CompiledExpression<T>::OpCode;
+    using Instruction = typename CompiledExpression<T>::Instruction;
+
+    std::vector<Instruction> code_;
+    std::vector<T> constants_;
+    std::vector<std::string> variables_;
+    std::vector<std::uint32_t> buffer_of_;
+    size_t buffer_count_;
+    Workspace workspace_;
+
+    void evaluateBlock(const T* const* columns, size_t offset, size_t count, T* out, RowError* errors,
+                       Workspace& workspace) const;
+};
+
+#include "batch_evaluator.tpp"
+
+#endif
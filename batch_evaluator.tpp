@@ -0,0 +1,251 @@
+#ifndef BATCH_EVALUATOR_TPP
+#define BATCH_EVALUATOR_TPP
+
+#include "batch_evaluator.hpp"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace batch_kernels {
+
+template <typename T, typename Op>
+inline void unary(T* dst, const T* a, size_t n, Op op) {
+    for (size_t j = 0; j < n; ++j) {
+        dst[j] = op(a[j]);
+    }
+}
+
+template <typename T, typename Op>
+inline void binary(T* dst, const T* a, const T* b, size_t n, Op op) {
+    for (size_t j = 0; j < n; ++j) {
+        dst[j] = op(a[j], b[j]);
+    }
+}
+
+// Records `code` for rows that have no earlier error and satisfy `failed`.
+template <typename T, typename Pred>
+inline void flag(std::uint8_t* errors, const T* a, size_t n, std::uint8_t code, Pred failed) {
+    for (size_t j = 0; j < n; ++j) {
+        std::uint8_t hit = static_cast<std::uint8_t>((errors[j] == 0) & failed(a[j]));
+        errors[j] = static_cast<std::uint8_t>(errors[j] | (hit * code));
+    }
+}
+
+}  // namespace batch_kernels
+
+template <typename T>
+BatchEvaluator<T>::BatchEvaluator(const CompiledExpression<T>& program)
+    : code_(program.instructions()),
+      constants_(program.constants()),
+      variables_(program.variables()),
+      buffer_of_(program.instructions().size(), 0),
+      buffer_count_(0) {
+    // Reuse block buffers once their register is dead, so the working set
+    // follows the expression's width rather than its size.
+    const size_t size = code_.size();
+    std::vector<size_t> last_use(size, 0);
+    for (size_t i = 0; i < size; ++i) {
+        const Instruction& ins = code_[i];
+        switch (ins.op) {
+            case OpCode::Constant:
+            case OpCode::Variable:
+                break;
+            case OpCode::CheckDivisor:
+            case OpCode::Sin:
+            case OpCode::Cos:
+            case OpCode::Ln:
+            case OpCode::Exp:
+                last_use[ins.lhs] = i;
+                break;
+            default:
+                last_use[ins.lhs] = i;
+                last_use[ins.rhs] = i;
+                break;
+        }
+    }
+    last_use[size - 1] = size;
+
+    std::vector<std::uint32_t> free_buffers;
+    auto release = [&](std::uint32_t reg, size_t at) {
+        if (code_[reg].op != OpCode::Variable && last_use[reg] == at) {
+            free_buffers.push_back(buffer_of_[reg]);
+        }
+    };
+    for (size_t i = 0; i < size; ++i) {
+        const Instruction& ins = code_[i];
+        if (ins.op == OpCode::Variable) {
+            continue;
+        }
+        if (ins.op == OpCode::CheckDivisor) {
+            release(ins.lhs, i);
+            continue;
+        }
+        if (ins.op != OpCode::Constant) {
+            release(ins.lhs, i);
+            bool is_unary = ins.op == OpCode::Sin || ins.op == OpCode::Cos || ins.op == OpCode::Ln ||
+                            ins.op == OpCode::Exp;
+            if (!is_unary && ins.rhs != ins.lhs) {
+                release(ins.rhs, i);
+            }
+        }
+        if (free_buffers.empty()) {
+            buffer_of_[i] = static_cast<std::uint32_t>(buffer_count_++);
+        } else {
+            buffer_of_[i] = free_buffers.back();
+            free_buffers.pop_back();
+        }
+    }
+
+    workspace_ = make_workspace();
+}
+
+template <typename T>
+const std::vector<std::string>& BatchEvaluator<T>::variables() const {
+    return variables_;
+}
+
+template <typename T>
+typename BatchEvaluator<T>::Workspace BatchEvaluator<T>::make_workspace() const {
+    Workspace workspace;
+    workspace.buffers.resize(buffer_count_ * block_size);
+    workspace.operands.resize(code_.size());
+    workspace.errors.resize(block_size);
+    return workspace;
+}
+
+template <typename T>
+T BatchEvaluator<T>::invalid_value() {
+    if constexpr (std::is_same_v<T, std::complex<double>>) {
+        double nan = std::numeric_limits<double>::quiet_NaN();
+        return T(nan, nan);
+    } else {
+        return std::numeric_limits<T>::quiet_NaN();
+    }
+}
+
+template <typename T>
+const char* BatchEvaluator<T>::error_message(RowError error) {
+    switch (error) {
+        case RowError::None:
+            return "";
+        case RowError::DivisionByZero:
+            return "Division by zero";
+        case RowError::LogarithmDomain:
+            if constexpr (std::is_same_v<T, std::complex<double>>) {
+                return "Logarithm of zero";
+            } else {
+                return "Logarithm of non-positive number";
+            }
+    }
+    return "Unknown error";
+}
+
+template <typename T>
+void BatchEvaluator<T>::evaluate(const T* const* columns, size_t rows, T* out, RowError* errors) {
+    evaluate(columns, rows, out, errors, workspace_);
+}
+
+template <typename T>
+void BatchEvaluator<T>::evaluate(const T* const* columns, size_t rows, T* out, RowError* errors,
+                                 Workspace& workspace) const {
+    for (size_t offset = 0; offset < rows; offset += block_size) {
+        size_t count = std::min(block_size, rows - offset);
+        evaluateBlock(columns, offset, count, out + offset, errors ? errors + offset : nullptr, workspace);
+    }
+}
+
+template <typename T>
+void BatchEvaluator<T>::evaluate(const std::unordered_map<std::string, const T*>& columns, size_t rows, T* out,
+                                 RowError* errors) {
+    std::vector<const T*> ordered(variables_.size());
+    for (size_t i = 0; i < variables_.size(); ++i) {
+        auto it = columns.find(variables_[i]);
+        if (it == columns.end()) {
+            throw std::runtime_error("Variable not found: " + variables_[i]);
+        }
+        ordered[i] = it->second;
+    }
+    evaluate(ordered.data(), rows, out, errors);
+}
+
+template <typename T>
+void BatchEvaluator<T>::evaluateBlock(const T* const* columns, size_t offset, size_t count, T* out,
+                                      RowError* errors, Workspace& workspace) const {
+    using namespace batch_kernels;
+
+    const T** operands = workspace.operands.data();
+    std::uint8_t* flags = workspace.errors.data();
+    std::fill(flags, flags + count, std::uint8_t(0));
+
+    for (size_t i = 0; i < code_.size(); ++i) {
+        const Instruction& ins = code_[i];
+        if (ins.op == OpCode::Variable) {
+            operands[i] = columns[ins.lhs] + offset;
+            continue;
+        }
+        if (ins.op == OpCode::CheckDivisor) {
+            flag(flags, operands[ins.lhs], count, static_cast<std::uint8_t>(RowError::DivisionByZero),
+                 [](const T& d) { return d == T(0); });
+            continue;
+        }
+
+        T* dst = workspace.buffers.data() + buffer_of_[i] * block_size;
+        const T* a = operands[ins.lhs];
+        const T* b = operands[ins.rhs];
+        switch (ins.op) {
+            case OpCode::Constant:
+                std::fill(dst, dst + count, constants_[ins.lhs]);
+                break;
+            case OpCode::Addition:
+                binary(dst, a, b, count, [](const T& x, const T& y) { return x + y; });
+                break;
+            case OpCode::Subtraction:
+                binary(dst, a, b, count, [](const T& x, const T& y) { return x - y; });
+                break;
+            case OpCode::Multiplication:
+                binary(dst, a, b, count, [](const T& x, const T& y) { return x * y; });
+                break;
+            case OpCode::Division:
+                binary(dst, a, b, count, [](const T& x, const T& y) { return x / y; });
+                break;
+            case OpCode::Exponentiation:
+                binary(dst, a, b, count, [](const T& x, const T& y) { return static_cast<T>(std::pow(x, y)); });
+                break;
+            case OpCode::Sin:
+                unary(dst, a, count, [](const T& x) { return static_cast<T>(std::sin(x)); });
+                break;
+            case OpCode::Cos:
+                unary(dst, a, count, [](const T& x) { return static_cast<T>(std::cos(x)); });
+                break;
+            case OpCode::Ln:
+                if constexpr (std::is_same_v<T, std::complex<double>>) {
+                    flag(flags, a, count, static_cast<std::uint8_t>(RowError::LogarithmDomain),
+                         [](const T& x) { return std::norm(x) == 0; });
+                } else {
+                    flag(flags, a, count, static_cast<std::uint8_t>(RowError::LogarithmDomain),
+                         [](const T& x) { return x <= 0; });
+                }
+                unary(dst, a, count, [](const T& x) { return static_cast<T>(std::log(x)); });
+                break;
+            case OpCode::Exp:
+                unary(dst, a, count, [](const T& x) { return static_cast<T>(std::exp(x)); });
+                break;
+            default:
+                break;
+        }
+        operands[i] = dst;
+    }
+
+    const T* result = operands[code_.size() - 1];
+    const T invalid = invalid_value();
+    for (size_t j = 0; j < count; ++j) {
+        out[j] = flags[j] ? invalid : result[j];
+    }
+    if (errors) {
+        for (size_t j = 0; j < count; ++j) {
+            errors[j] = static_cast<RowError>(flags[j]);
+        }
+    }
+}
+
+#endif
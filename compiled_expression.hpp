@@ -0,0 +1,83 @@
+#ifndef COMPILED_EXPRESSION_HPP
+#define COMPILED_EXPRESSION_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "expression.hpp"
+
+template <typename T>
+struct Gradient {
+    T value;
+    std::unordered_map<std::string, T> partials;
+};
+
+// Flat, register-based form of an Expression. Every instruction writes the
+// register with its own index, operands always refer to earlier registers and
+// variables are resolved once to integer slots, so evaluation is a single
+// forward pass over a contiguous array.
+template <typename T>
+class CompiledExpression {
+public:
+    enum class OpCode : std::uint8_t {
+        Constant, Variable, Addition, Subtraction, Multiplication, Division,
+        Exponentiation, Sin, Cos, Ln, Exp, CheckDivisor
+    };
+
+    // Constant: lhs indexes constants(). Variable: lhs is the variable slot.
+    // CheckDivisor: throws if register lhs is zero, writes no value.
+    struct Instruction {
+        OpCode op;
+        std::uint32_t lhs;
+        std::uint32_t rhs;
+    };
+
+    explicit CompiledExpression(const Expression<T>& expr);
+
+    size_t variable_count() const;
+    const std::vector<std::string>& variables() const;
+    size_t slot(const std::string& name) const;
+
+    const std::vector<Instruction>& instructions() const;
+    const std::vector<T>& constants() const;
+    size_t register_count() const;
+
+    // values[slot] holds the binding of variables()[slot].
+    T evaluate(const T* values);
+    T evaluate(const T* values, T* registers) const;
+
+    T calculate(const std::unordered_map<std::string, T>& variables);
+
+    // Runs instruction i alone; its operands must already be in registers.
+    void execute(size_t i, const T* values, T* registers) const;
+
+    // Reverse-mode differentiation: one forward pass, then one backward pass
+    // that accumulates adjoints. partials[slot] receives the derivative with
+    // respect to variables()[slot]; the value is returned.
+    T gradient(const T* values, T* partials);
+    T gradient(const T* values, T* partials, T* registers, T* adjoints) const;
+    Gradient<T> gradient(const std::unordered_map<std::string, T>& variables);
+
+    static T checkedLn(const T& argument);
+
+private:
+    std::vector<Instruction> code_;
+    std::vector<T> constants_;
+    std::vector<std::string> variables_;
+    std::unordered_map<std::string, size_t> slots_;
+    std::vector<bool> varying_;
+    std::vector<T> registers_;
+    std::vector<T> adjoints_;
+    std::vector<T> bindings_;
+
+    void bind(const std::unordered_map<std::string, T>& variables);
+    void execute(const Instruction& ins, size_t i, const T* values, T* registers) const;
+
+    std::uint32_t emit(OpCode op, std::uint32_t lhs = 0, std::uint32_t rhs = 0);
+    std::uint32_t slotFor(const std::string& name);
+};
+
+#include "compiled_expression.tpp"
+
+#endif
@@ -0,0 +1,373 @@
+#ifndef COMPILED_EXPRESSION_TPP
+#define COMPILED_EXPRESSION_TPP
+
+#include "compiled_expression.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+template <typename T>
+CompiledExpression<T>::CompiledExpression(const Expression<T>& expr) {
+    using Type = typename Expression<T>::Type;
+
+    // Post-order walk with an explicit stack; operands are visited in the
+    // same order as Expression::calculate so errors surface identically.
+    // Shared nodes are emitted once and reused by register.
+    struct Frame {
+        const Expression<T>* node;
+        int stage;
+    };
+    std::vector<Frame> stack{{&expr, 0}};
+    std::vector<std::uint32_t> results;
+    std::unordered_map<const Expression<T>*, std::uint32_t> emitted;
+    auto finish = [&](const Expression<T>* node, std::uint32_t reg) {
+        results.push_back(reg);
+        emitted.emplace(node, reg);
+        stack.pop_back();
+    };
+
+    while (!stack.empty()) {
+        const Expression<T>* node = stack.back().node;
+        int stage = stack.back().stage;
+
+        if (stage == 0) {
+            auto it = emitted.find(node);
+            if (it != emitted.end()) {
+                results.push_back(it->second);
+                stack.pop_back();
+                continue;
+            }
+        }
+
+        switch (node->type) {
+            case Type::Number:
+                constants_.push_back(node->value);
+                finish(node, emit(OpCode::Constant, static_cast<std::uint32_t>(constants_.size() - 1)));
+                break;
+
+            case Type::Variable:
+                finish(node, emit(OpCode::Variable, slotFor(node->variable_name)));
+                break;
+
+            case Type::Division:
+                if (stage == 0) {
+                    stack.back().stage = 1;
+                    stack.push_back({node->node_right.get(), 0});
+                } else if (stage == 1) {
+                    stack.back().stage = 2;
+                    emit(OpCode::CheckDivisor, results.back());
+                    stack.push_back({node->node_left.get(), 0});
+                } else {
+                    std::uint32_t left = results.back();
+                    results.pop_back();
+                    std::uint32_t right = results.back();
+                    results.pop_back();
+                    finish(node, emit(OpCode::Division, left, right));
+                }
+                break;
+
+            case Type::Addition:
+            case Type::Subtraction:
+            case Type::Multiplication:
+            case Type::Exponentiation:
+                if (stage == 0) {
+                    stack.back().stage = 1;
+                    stack.push_back({node->node_left.get(), 0});
+                } else if (stage == 1) {
+                    stack.back().stage = 2;
+                    stack.push_back({node->node_right.get(), 0});
+                } else {
+                    std::uint32_t right = results.back();
+                    results.pop_back();
+                    std::uint32_t left = results.back();
+                    results.pop_back();
+                    OpCode op = node->type == Type::Addition ? OpCode::Addition
+                              : node->type == Type::Subtraction ? OpCode::Subtraction
+                              : node->type == Type::Multiplication ? OpCode::Multiplication
+                              : OpCode::Exponentiation;
+                    finish(node, emit(op, left, right));
+                }
+                break;
+
+            case Type::Sin:
+            case Type::Cos:
+            case Type::Ln:
+            case Type::Exp:
+                if (stage == 0) {
+                    stack.back().stage = 1;
+                    stack.push_back({node->node_left.get(), 0});
+                } else {
+                    std::uint32_t argument = results.back();
+                    results.pop_back();
+                    OpCode op = node->type == Type::Sin ? OpCode::Sin
+                              : node->type == Type::Cos ? OpCode::Cos
+                              : node->type == Type::Ln ? OpCode::Ln
+                              : OpCode::Exp;
+                    finish(node, emit(op, argument));
+                }
+                break;
+
+            default:
+                throw std::runtime_error("Unsupported operation type during compilation");
+        }
+    }
+
+    // Registers that depend on no variable need no adjoint for their
+    // operands (e.g. the exponent of x ^ 2 never takes a logarithm).
+    varying_.assign(code_.size(), false);
+    for (size_t i = 0; i < code_.size(); ++i) {
+        const Instruction& ins = code_[i];
+        switch (ins.op) {
+            case OpCode::Constant:
+            case OpCode::CheckDivisor:
+                break;
+            case OpCode::Variable:
+                varying_[i] = true;
+                break;
+            case OpCode::Sin:
+            case OpCode::Cos:
+            case OpCode::Ln:
+            case OpCode::Exp:
+                varying_[i] = varying_[ins.lhs];
+                break;
+            default:
+                varying_[i] = varying_[ins.lhs] || varying_[ins.rhs];
+                break;
+        }
+    }
+
+    registers_.resize(code_.size());
+    adjoints_.resize(code_.size());
+    bindings_.resize(variables_.size());
+}
+
+template <typename T>
+std::uint32_t CompiledExpression<T>::emit(OpCode op, std::uint32_t lhs, std::uint32_t rhs) {
+    code_.push_back({op, lhs, rhs});
+    return static_cast<std::uint32_t>(code_.size() - 1);
+}
+
+template <typename T>
+std::uint32_t CompiledExpression<T>::slotFor(const std::string& name) {
+    auto it = slots_.find(name);
+    if (it != slots_.end()) {
+        return static_cast<std::uint32_t>(it->second);
+    }
+    variables_.push_back(name);
+    slots_.emplace(name, variables_.size() - 1);
+    return static_cast<std::uint32_t>(variables_.size() - 1);
+}
+
+template <typename T>
+size_t CompiledExpression<T>::variable_count() const {
+    return variables_.size();
+}
+
+template <typename T>
+const std::vector<std::string>& CompiledExpression<T>::variables() const {
+    return variables_;
+}
+
+template <typename T>
+size_t CompiledExpression<T>::slot(const std::string& name) const {
+    auto it = slots_.find(name);
+    if (it == slots_.end()) {
+        throw std::runtime_error("Variable not found: " + name);
+    }
+    return it->second;
+}
+
+template <typename T>
+const std::vector<typename CompiledExpression<T>::Instruction>& CompiledExpression<T>::instructions() const {
+    return code_;
+}
+
+template <typename T>
+const std::vector<T>& CompiledExpression<T>::constants() const {
+    return constants_;
+}
+
+template <typename T>
+size_t CompiledExpression<T>::register_count() const {
+    return code_.size();
+}
+
+template <typename T>
+T CompiledExpression<T>::checkedLn(const T& argument) {
+    if constexpr (std::is_same_v<T, std::complex<double>>) {
+        if (std::norm(argument) == 0) {
+            throw std::runtime_error("Logarithm of zero");
+        }
+    } else {
+        if (argument <= 0) {
+            throw std::runtime_error("Logarithm of non-positive number");
+        }
+    }
+    return static_cast<T>(std::log(argument));
+}
+
+template <typename T>
+T CompiledExpression<T>::evaluate(const T* values) {
+    return evaluate(values, registers_.data());
+}
+
+template <typename T>
+T CompiledExpression<T>::evaluate(const T* values, T* registers) const {
+    const Instruction* code = code_.data();
+    const size_t size = code_.size();
+
+    for (size_t i = 0; i < size; ++i) {
+        execute(code[i], i, values, registers);
+    }
+    return registers[size - 1];
+}
+
+template <typename T>
+void CompiledExpression<T>::execute(size_t i, const T* values, T* registers) const {
+    execute(code_[i], i, values, registers);
+}
+
+template <typename T>
+inline void CompiledExpression<T>::execute(const Instruction& ins, size_t i, const T* values, T* registers) const {
+    switch (ins.op) {
+        case OpCode::Constant:
+            registers[i] = constants_[ins.lhs];
+            break;
+        case OpCode::Variable:
+            registers[i] = values[ins.lhs];
+            break;
+        case OpCode::Addition:
+            registers[i] = registers[ins.lhs] + registers[ins.rhs];
+            break;
+        case OpCode::Subtraction:
+            registers[i] = registers[ins.lhs] - registers[ins.rhs];
+            break;
+        case OpCode::Multiplication:
+            registers[i] = registers[ins.lhs] * registers[ins.rhs];
+            break;
+        case OpCode::CheckDivisor:
+            if (registers[ins.lhs] == T(0)) {
+                throw std::runtime_error("Division by zero");
+            }
+            break;
+        case OpCode::Division:
+            registers[i] = registers[ins.lhs] / registers[ins.rhs];
+            break;
+        case OpCode::Exponentiation:
+            registers[i] = static_cast<T>(std::pow(registers[ins.lhs], registers[ins.rhs]));
+            break;
+        case OpCode::Sin:
+            registers[i] = static_cast<T>(std::sin(registers[ins.lhs]));
+            break;
+        case OpCode::Cos:
+            registers[i] = static_cast<T>(std::cos(registers[ins.lhs]));
+            break;
+        case OpCode::Ln:
+            registers[i] = checkedLn(registers[ins.lhs]);
+            break;
+        case OpCode::Exp:
+            registers[i] = static_cast<T>(std::exp(registers[ins.lhs]));
+            break;
+    }
+}
+
+template <typename T>
+void CompiledExpression<T>::bind(const std::unordered_map<std::string, T>& variables) {
+    for (size_t i = 0; i < variables_.size(); ++i) {
+        auto it = variables.find(variables_[i]);
+        if (it == variables.end()) {
+            throw std::runtime_error("Variable not found: " + variables_[i]);
+        }
+        bindings_[i] = it->second;
+    }
+}
+
+template <typename T>
+T CompiledExpression<T>::calculate(const std::unordered_map<std::string, T>& variables) {
+    bind(variables);
+    return evaluate(bindings_.data());
+}
+
+template <typename T>
+T CompiledExpression<T>::gradient(const T* values, T* partials) {
+    return gradient(values, partials, registers_.data(), adjoints_.data());
+}
+
+template <typename T>
+T CompiledExpression<T>::gradient(const T* values, T* partials, T* registers, T* adjoints) const {
+    const T result = evaluate(values, registers);
+    const size_t size = code_.size();
+
+    std::fill(adjoints, adjoints + size, T(0));
+    std::fill(partials, partials + variables_.size(), T(0));
+    adjoints[size - 1] = T(1);
+
+    for (size_t i = size; i-- > 0;) {
+        const Instruction& ins = code_[i];
+        const T adjoint = adjoints[i];
+        if (!varying_[i]) {
+            continue;
+        }
+        switch (ins.op) {
+            case OpCode::Constant:
+            case OpCode::CheckDivisor:
+                break;
+            case OpCode::Variable:
+                partials[ins.lhs] += adjoint;
+                break;
+            case OpCode::Addition:
+                adjoints[ins.lhs] += adjoint;
+                adjoints[ins.rhs] += adjoint;
+                break;
+            case OpCode::Subtraction:
+                adjoints[ins.lhs] += adjoint;
+                adjoints[ins.rhs] -= adjoint;
+                break;
+            case OpCode::Multiplication:
+                adjoints[ins.lhs] += adjoint * registers[ins.rhs];
+                adjoints[ins.rhs] += adjoint * registers[ins.lhs];
+                break;
+            case OpCode::Division:
+                adjoints[ins.lhs] += adjoint / registers[ins.rhs];
+                adjoints[ins.rhs] -= adjoint * registers[i] / registers[ins.rhs];
+                break;
+            case OpCode::Exponentiation: {
+                const T base = registers[ins.lhs];
+                const T exponent = registers[ins.rhs];
+                if (varying_[ins.lhs]) {
+                    adjoints[ins.lhs] += adjoint * exponent * static_cast<T>(std::pow(base, exponent - T(1)));
+                }
+                if (varying_[ins.rhs]) {
+                    adjoints[ins.rhs] += adjoint * registers[i] * checkedLn(base);
+                }
+                break;
+            }
+            case OpCode::Sin:
+                adjoints[ins.lhs] += adjoint * static_cast<T>(std::cos(registers[ins.lhs]));
+                break;
+            case OpCode::Cos:
+                adjoints[ins.lhs] -= adjoint * static_cast<T>(std::sin(registers[ins.lhs]));
+                break;
+            case OpCode::Ln:
+                adjoints[ins.lhs] += adjoint / registers[ins.lhs];
+                break;
+            case OpCode::Exp:
+                adjoints[ins.lhs] += adjoint * registers[i];
+                break;
+        }
+    }
+    return result;
+}
+
+template <typename T>
+Gradient<T> CompiledExpression<T>::gradient(const std::unordered_map<std::string, T>& variables) {
+    bind(variables);
+    std::vector<T> partials(variables_.size());
+    Gradient<T> result;
+    result.value = gradient(bindings_.data(), partials.data());
+    for (size_t i = 0; i < variables_.size(); ++i) {
+        result.partials.emplace(variables_[i], partials[i]);
+    }
+    return result;
+}
+
+#endif
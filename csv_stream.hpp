@@ -0,0 +1,58 @@
+#ifndef CSV_STREAM_HPP
+#define CSV_STREAM_HPP
+
+#include <complex>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Helpers behind `differentiator --eval-stream`: CSV rows whose header names
+// the variables go in, "result,error" rows come out.
+
+// Buffered line splitter over a FILE*; strips a trailing '\r'.
+class LineReader {
+public:
+    explicit LineReader(std::FILE* file);
+
+    // The returned view is valid until the next call.
+    bool next(std::string_view& line);
+
+private:
+    std::FILE* file_;
+    std::vector<char> buffer_;
+    size_t begin_ = 0;
+    size_t end_ = 0;
+    bool eof_ = false;
+};
+
+std::string_view trim(std::string_view str);
+std::vector<std::string_view> splitFields(std::string_view line);
+
+// Whole-string conversions without locale or regex; a leading '+' is allowed.
+bool parseFastReal(std::string_view str, double& value);
+// Accepts "a", "bi", "a+bi", "a-bi", "i", "-i" and the like.
+bool parseFastComplex(std::string_view str, std::complex<double>& value);
+
+void appendValue(std::string& out, double value);
+void appendValue(std::string& out, const std::complex<double>& value);
+
+// Evaluates the expression over the rows after the header and firstRow, in
+// blocks; a bad row gets an error message and never stops the run.
+template <typename T>
+void streamEvaluate(const std::string& expressionStr, const std::vector<std::string>& header,
+                    const std::string& firstRow, LineReader& reader, std::FILE* output);
+
+// True if the first row needs complex evaluation (see csv_stream.tpp).
+bool streamNeedsComplex(const std::string& expressionStr, const std::vector<std::string>& header,
+                        const std::string& firstRow);
+
+// Reads the header, picks real or complex mode and streams the rest. Unless
+// forceComplex is set, the mode is chosen from the first data row only, so a
+// complex value in a later row of a real stream is an invalid number.
+void evaluateCsvStream(const std::string& expressionStr, std::FILE* input, std::FILE* output,
+                       bool forceComplex = false);
+
+#include "csv_stream.tpp"
+
+#endif
@@ -0,0 +1,288 @@
+#ifndef CSV_STREAM_TPP
+#define CSV_STREAM_TPP
+
+#include "csv_stream.hpp"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include "batch_evaluator.hpp"
+#include "compiled_expression.hpp"
+
+inline LineReader::LineReader(std::FILE* file) : file_(file), buffer_(1 << 20) {}
+
+inline bool LineReader::next(std::string_view& line) {
+    while (true) {
+        const char* start = buffer_.data() + begin_;
+        const char* newline = static_cast<const char*>(std::memchr(start, '\n', end_ - begin_));
+        if (newline || (eof_ && begin_ < end_)) {
+            size_t length = newline ? static_cast<size_t>(newline - start) : end_ - begin_;
+            begin_ += newline ? length + 1 : length;
+            if (length > 0 && start[length - 1] == '\r') {
+                length--;
+            }
+            line = std::string_view(start, length);
+            return true;
+        }
+        if (eof_) {
+            return false;
+        }
+        std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+        end_ -= begin_;
+        begin_ = 0;
+        if (end_ == buffer_.size()) {
+            buffer_.resize(buffer_.size() * 2);
+        }
+        size_t read = std::fread(buffer_.data() + end_, 1, buffer_.size() - end_, file_);
+        end_ += read;
+        eof_ = read == 0;
+    }
+}
+
+inline std::string_view trim(std::string_view str) {
+    while (!str.empty() && std::isspace(static_cast<unsigned char>(str.front()))) {
+        str.remove_prefix(1);
+    }
+    while (!str.empty() && std::isspace(static_cast<unsigned char>(str.back()))) {
+        str.remove_suffix(1);
+    }
+    return str;
+}
+
+inline std::vector<std::string_view> splitFields(std::string_view line) {
+    std::vector<std::string_view> fields;
+    size_t start = 0;
+    while (true) {
+        size_t comma = line.find(',', start);
+        fields.push_back(trim(line.substr(start, comma == std::string_view::npos ? comma : comma - start)));
+        if (comma == std::string_view::npos) {
+            return fields;
+        }
+        start = comma + 1;
+    }
+}
+
+inline bool parseFastReal(std::string_view str, double& value) {
+    if (!str.empty() && str.front() == '+') {
+        str.remove_prefix(1);
+    }
+    if (str.empty()) {
+        return false;
+    }
+    auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+    return ec == std::errc() && end == str.data() + str.size();
+}
+
+inline bool parseFastComplex(std::string_view str, std::complex<double>& value) {
+    if (str.empty() || str.back() != 'i') {
+        double real;
+        if (!parseFastReal(str, real)) {
+            return false;
+        }
+        value = std::complex<double>(real, 0.0);
+        return true;
+    }
+    str.remove_suffix(1);
+
+    size_t split = std::string_view::npos;
+    for (size_t k = str.size(); k-- > 1;) {
+        if ((str[k] == '+' || str[k] == '-') && str[k - 1] != 'e' && str[k - 1] != 'E') {
+            split = k;
+            break;
+        }
+    }
+    double real = 0.0;
+    std::string_view imagPart = str;
+    if (split != std::string_view::npos) {
+        if (!parseFastReal(str.substr(0, split), real)) {
+            return false;
+        }
+        imagPart = str.substr(split);
+    }
+
+    double imag;
+    if (imagPart.empty() || imagPart == "+") {
+        imag = 1.0;
+    } else if (imagPart == "-") {
+        imag = -1.0;
+    } else if (!parseFastReal(imagPart, imag)) {
+        return false;
+    }
+    value = std::complex<double>(real, imag);
+    return true;
+}
+
+inline bool parseFast(std::string_view str, double& value) {
+    return parseFastReal(str, value);
+}
+
+inline bool parseFast(std::string_view str, std::complex<double>& value) {
+    return parseFastComplex(str, value);
+}
+
+inline void appendValue(std::string& out, double value) {
+    char buffer[32];
+    auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out.append(buffer, end);
+}
+
+inline void appendValue(std::string& out, const std::complex<double>& value) {
+    appendValue(out, value.real());
+    if (value.imag() != 0) {
+        if (value.imag() > 0) {
+            out.push_back('+');
+        }
+        appendValue(out, value.imag());
+        out.push_back('i');
+    }
+}
+
+template <typename T>
+void streamEvaluate(const std::string& expressionStr, const std::vector<std::string>& header,
+                    const std::string& firstRow, LineReader& reader, std::FILE* output) {
+    CompiledExpression<T> program(Expression<T>::parse(expressionStr));
+    BatchEvaluator<T> evaluator(program);
+    const std::vector<std::string>& names = program.variables();
+
+    const size_t blockRows = BatchEvaluator<T>::block_size * 16;
+    std::vector<std::vector<T>> columns(names.size(), std::vector<T>(blockRows));
+    std::vector<const T*> columnPointers(names.size());
+    std::vector<int> slotOfField(header.size(), -1);
+    for (size_t slot = 0; slot < names.size(); ++slot) {
+        auto it = std::find(header.begin(), header.end(), names[slot]);
+        if (it != header.end()) {
+            slotOfField[it - header.begin()] = static_cast<int>(slot);
+        } else if (names[slot] == "i" && std::is_same_v<T, std::complex<double>>) {
+            if constexpr (std::is_same_v<T, std::complex<double>>) {
+                std::fill(columns[slot].begin(), columns[slot].end(), std::complex<double>(0.0, 1.0));
+            }
+        } else {
+            throw std::runtime_error("Variable not found in header: " + names[slot]);
+        }
+        columnPointers[slot] = columns[slot].data();
+    }
+
+    std::vector<T> results(blockRows);
+    std::vector<RowError> errors(blockRows);
+    std::vector<std::string> parseErrors(blockRows);
+    std::string out = "result,error\n";
+    out.reserve(1 << 21);
+
+    size_t rows = 0;
+    auto flush = [&]() {
+        evaluator.evaluate(columnPointers.data(), rows, results.data(), errors.data());
+        for (size_t row = 0; row < rows; ++row) {
+            if (!parseErrors[row].empty()) {
+                out += ",";
+                out += parseErrors[row];
+                parseErrors[row].clear();
+            } else if (errors[row] != RowError::None) {
+                out += ",";
+                out += BatchEvaluator<T>::error_message(errors[row]);
+            } else {
+                appendValue(out, results[row]);
+                out += ",";
+            }
+            out += "\n";
+            if (out.size() >= (1 << 20)) {
+                std::fwrite(out.data(), 1, out.size(), output);
+                out.clear();
+            }
+        }
+        rows = 0;
+    };
+    auto addRow = [&](std::string_view line) {
+        size_t field = 0;
+        size_t start = 0;
+        bool extraFields = false;
+        while (field < header.size()) {
+            size_t comma = line.find(',', start);
+            std::string_view cell = trim(line.substr(start, comma == std::string_view::npos ? comma : comma - start));
+            int slot = slotOfField[field];
+            if (slot >= 0 && !parseFast(cell, columns[slot][rows]) && parseErrors[rows].empty()) {
+                parseErrors[rows] = "Invalid number: " + std::string(cell);
+            }
+            field++;
+            // A comma after the last header field means the row is too long.
+            extraFields = comma != std::string_view::npos;
+            if (!extraFields) {
+                break;
+            }
+            start = comma + 1;
+        }
+        if (field != header.size() || extraFields) {
+            parseErrors[rows] = "Expected " + std::to_string(header.size()) + " values";
+        }
+        if (++rows == blockRows) {
+            flush();
+        }
+    };
+
+    addRow(firstRow);
+    std::string_view line;
+    while (reader.next(line)) {
+        if (!trim(line).empty()) {
+            addRow(line);
+        }
+    }
+    flush();
+    std::fwrite(out.data(), 1, out.size(), output);
+    std::fflush(output);
+}
+
+// Complex mode is needed when a column the expression reads holds a value
+// that only parses as complex, or when it uses i without an "i" column.
+// Other columns are ignored, and "inf"/"nan" stay real.
+inline bool streamNeedsComplex(const std::string& expressionStr, const std::vector<std::string>& header,
+                        const std::string& firstRow) {
+    CompiledExpression<double> program(Expression<double>::parse(expressionStr));
+    std::vector<std::string_view> cells = splitFields(firstRow);
+    for (const std::string& name : program.variables()) {
+        auto it = std::find(header.begin(), header.end(), name);
+        if (it == header.end()) {
+            if (name == "i") {
+                return true;
+            }
+            continue;
+        }
+        size_t field = it - header.begin();
+        double real;
+        std::complex<double> complex;
+        if (field < cells.size() && !parseFastReal(cells[field], real) && parseFastComplex(cells[field], complex)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void evaluateCsvStream(const std::string& expressionStr, std::FILE* input, std::FILE* output,
+                              bool forceComplex) {
+    LineReader reader(input);
+    std::string_view line;
+    if (!reader.next(line)) {
+        throw std::runtime_error("Missing CSV header");
+    }
+    std::vector<std::string> header;
+    for (std::string_view field : splitFields(line)) {
+        header.emplace_back(field);
+    }
+
+    std::string firstRow;
+    while (reader.next(line)) {
+        if (!trim(line).empty()) {
+            firstRow = std::string(line);
+            break;
+        }
+    }
+    if (firstRow.empty()) {
+        std::fputs("result,error\n", output);
+    } else if (forceComplex || streamNeedsComplex(expressionStr, header, firstRow)) {
+        streamEvaluate<std::complex<double>>(expressionStr, header, firstRow, reader, output);
+    } else {
+        streamEvaluate<double>(expressionStr, header, firstRow, reader, output);
+    }
+}
+
+#endif
@@ -3,21 +3,49 @@
 
 #include <iostream>
 #include <memory>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <map>
 #include <cmath>
 #include <complex>
 #include <unordered_map>
 #include <memory>
+#include <mutex>
+#include <vector>
+
+// Build with -DEXPRESSION_COUNTERS to record node allocations, copies and
+// evaluation visits across all value types (see ExpressionBench.cpp).
+#ifdef EXPRESSION_COUNTERS
+#include <atomic>
+
+namespace expression_counters {
+inline std::atomic<unsigned long long> node_allocations{0};
+inline std::atomic<unsigned long long> copies{0};
+inline std::atomic<unsigned long long> evaluation_visits{0};
+
+inline void reset() {
+    node_allocations = 0;
+    copies = 0;
+    evaluation_visits = 0;
+}
+}  // namespace expression_counters
+
+#define EXPRESSION_COUNT(counter) expression_counters::counter.fetch_add(1, std::memory_order_relaxed)
+#else
+#define EXPRESSION_COUNT(counter) ((void)0)
+#endif
 
 template <typename T>
 class Expression {
 public:
+    // Child nodes are hash-consed: structurally identical subexpressions are a
+    // single shared node, so they are only reachable as const.
     T value;
     std::string variable_name;
     enum Type { Variable, Number, Addition, Subtraction, Multiplication, Division, Exponentiation, Sin, Cos, Ln, Exp };
-    std::shared_ptr<Expression<T>> node_left;
-    std::shared_ptr<Expression<T>> node_right;
+    std::shared_ptr<const Expression<T>> node_left;
+    std::shared_ptr<const Expression<T>> node_right;
     Type type;
 
     Expression(T number);
@@ -30,11 +58,15 @@ public:
     Expression(Expression&& other) noexcept = default;
     Expression& operator=(Expression&& other) noexcept = default;
 
-    static Expression<T> parse(const std::string& expr);
+    // Iterative operator-precedence parser: stack use does not depend on the
+    // nesting depth and errors report the character offset. The other tree
+    // walks are iterative as well, so a parsed tree of any depth can be
+    // evaluated, differentiated, simplified and printed.
+    static Expression<T> parse(std::string_view expr);
 
     Expression substitute(const std::string& var_name, const Expression& replacement) const;
 
-    ~Expression() = default;
+    ~Expression();
 
     Expression operator+(const Expression& other) const;
     Expression operator-(const Expression& other) const;
@@ -46,21 +78,159 @@ public:
     Expression ln() const;
     Expression exp() const;
 
-    T calculate();
-    T calculate(std::unordered_map<std::string, T>& variables);
+    // Evaluation never modifies the expression, so one expression may be
+    // evaluated from several threads at once, also while other threads
+    // build, copy or destroy expressions that share its nodes.
+    T calculate() const;
+    T calculate(const std::unordered_map<std::string, T>& variables) const;
 
-    std::string to_string();
+    std::string to_string() const;
 
     Expression<T> differentiate(const std::string& var_name) const;
+    Expression<T> differentiate(const std::string& var_name, bool simplify_result) const;
+
+    struct SimplifyReport {
+        size_t nodes_before = 0;
+        size_t nodes_after = 0;
+        size_t passes = 0;
+    };
+
+    // Constant folding, identity/annihilator elimination, sign normalization
+    // and power-rule rewriting, repeated until the expression stops changing.
+    Expression<T> simplify(SimplifyReport* report = nullptr) const;
+
+    // Number of distinct nodes, counting each shared subexpression once.
+    size_t node_count() const;
+
+    // Node storage counters for this value type; live_nodes counts nodes
+    // currently held by any expression, arena_chunks/arena_bytes the chunks
+    // currently reserved. peak_arena_bytes is the most reserved at once
+    // since the last reset_allocation_stats().
+    struct AllocationStats {
+        size_t nodes_allocated = 0;
+        size_t nodes_released = 0;
+        size_t live_nodes = 0;
+        size_t intern_hits = 0;
+        size_t arena_chunks = 0;
+        size_t arena_bytes = 0;
+        size_t peak_arena_bytes = 0;
+    };
+    static AllocationStats allocation_stats();
+    static void reset_allocation_stats();
 
 private:
-    static Expression<T> parseExpression(const std::string& expr, size_t& pos);
-    static Expression<T> parseTerm(const std::string& expr, size_t& pos);
-    static Expression<T> parsePower(const std::string& expr, size_t& pos);
-    static Expression<T> parseFactor(const std::string& expr, size_t& pos);
-    static Expression<T> parseNumber(const std::string& expr, size_t& pos);
-    static Expression<T> parseFunctionOrVariable(const std::string& expr, size_t& pos);
-    static void skipWhitespace(const std::string& expr, size_t& pos);
+    // Fixed-size block pool that owns the storage of every node (together
+    // with its reference count) of this value type. Blocks are carved from
+    // chunks aligned to their own size, so a released block finds its chunk
+    // by masking its address. A chunk is returned to the system as soon as
+    // all of its blocks are released, except that one empty chunk is kept as
+    // a spare so that a workload hovering at a chunk boundary does not
+    // allocate and free a chunk per node. Memory is only given back when a
+    // whole chunk empties: a few surviving nodes pin their chunks.
+    struct NodeArena {
+        static constexpr size_t chunk_bytes = 64 * 1024;
+
+        struct Chunk {
+            // Chunks with free blocks form a doubly linked list.
+            Chunk* prev = nullptr;
+            Chunk* next = nullptr;
+            bool listed = false;
+            void* free_list = nullptr;
+            unsigned char* cursor = nullptr;
+            unsigned char* end = nullptr;
+            size_t live = 0;
+        };
+
+        std::mutex mutex;
+        Chunk* available = nullptr;
+        Chunk* spare = nullptr;
+        size_t block_size = 0;
+        AllocationStats stats;
+
+        void* allocate(size_t bytes);
+        void deallocate(void* block, size_t bytes);
+        Chunk* newChunk();
+        void resetChunk(Chunk* chunk);
+        void link(Chunk* chunk);
+        void unlink(Chunk* chunk);
+    };
+
+    template <typename U>
+    struct ArenaAllocator {
+        using value_type = U;
+        template <typename V>
+        struct rebind {
+            using other = ArenaAllocator<V>;
+        };
+
+        ArenaAllocator() = default;
+        template <typename V>
+        ArenaAllocator(const ArenaAllocator<V>&) {}
+
+        U* allocate(size_t n) { return static_cast<U*>(nodeArena().allocate(n * sizeof(U))); }
+        void deallocate(U* p, size_t n) { nodeArena().deallocate(p, n * sizeof(U)); }
+
+        template <typename V>
+        bool operator==(const ArenaAllocator<V>&) const { return true; }
+        template <typename V>
+        bool operator!=(const ArenaAllocator<V>&) const { return false; }
+    };
+
+    struct NodeKey {
+        Type type;
+        const Expression<T>* left;
+        const Expression<T>* right;
+        T value;
+        std::string variable_name;
+        bool operator==(const NodeKey& other) const;
+    };
+    struct NodeKeyHash {
+        size_t operator()(const NodeKey& key) const;
+    };
+    // An interned node erases its own entry when it dies; the entry's weak
+    // reference would otherwise keep the node's arena block allocated.
+    struct NodeEntry {
+        std::weak_ptr<const Expression<T>> owner;
+        const Expression<T>* node;
+    };
+    struct NodeTable {
+        std::mutex mutex;
+        std::unordered_map<NodeKey, NodeEntry, NodeKeyHash> nodes;
+        size_t hits = 0;
+    };
+
+    static NodeArena& nodeArena();
+    static NodeTable& nodeTable();
+    static std::shared_ptr<const Expression<T>> intern(Expression<T>&& node);
+    static NodeKey keyOf(const Expression<T>& node);
+    static void forget(NodeTable& table, const Expression<T>& node);
+    static bool soleOwner(const std::shared_ptr<const Expression<T>>& node);
+
+    bool interned_ = false;
+
+    // calculate() and differentiate() reuse the result of a child when it is
+    // shared, i.e. another reference to it exists at the time of the check,
+    // possibly one held by another thread. That count can change at any
+    // moment, so it only decides whether a result is cached; cached and
+    // recomputed results are the same.
+    static bool shared(const std::shared_ptr<const Expression<T>>& child);
+
+    // Post-order walk with an explicit stack. combine(node, children) builds
+    // the result of a node from those of its children (left first); results
+    // of children for which share(child) holds are computed once per walk.
+    template <typename R, typename Share, typename Combine>
+    static R fold(const Expression<T>& root, Share share, Combine combine);
+
+    // One bottom-up simplification pass over every distinct node.
+    Expression<T> simplifyOnce() const;
+    static Expression<T> rewrite(Type op, Expression<T> a, Expression<T> b);
+    static Expression<T> rewrite(Type op, Expression<T> a);
+    bool isNumber(T number) const;
+    bool sameNode(const Expression<T>& other) const;
+
+    static Expression<T> parseNumber(std::string_view expr, size_t& pos);
+    static std::runtime_error parseError(const std::string& message, size_t offset);
+    static void skipWhitespace(std::string_view expr, size_t& pos);
 };
 
 #include "expression1.tpp"
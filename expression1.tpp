@@ -2,7 +2,17 @@
 #define EXPRESSION_TPP
 
 #include "expression.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <new>
 #include <stdexcept>
+#include <string_view>
 
 template <typename T>
 Expression<T>::Expression(T number) {
@@ -18,22 +28,25 @@ Expression<T>::Expression(std::string variable) {
     node_left = nullptr;
     node_right = nullptr;
     type = Type::Variable;
+    value = T();
     variable_name = variable;
 }
 
 template <typename T>
 Expression<T>::Expression(Type op, Expression<T> a, Expression<T> b) {
-    node_left = std::make_shared<Expression<T>>(a);
-    node_right = std::make_shared<Expression<T>>(b);
+    node_left = intern(std::move(a));
+    node_right = intern(std::move(b));
     type = op;
+    value = T();
     variable_name = "";
 }
 
 template <typename T>
 Expression<T>::Expression(Type op, Expression<T> a) {
-    node_left = std::make_shared<Expression<T>>(a);
+    node_left = intern(std::move(a));
     node_right = nullptr;
     type = op;
+    value = T();
     variable_name = "";
 }
 
@@ -41,56 +54,499 @@ template <typename T>
 Expression<T>::Expression(const Expression& other)
     : value(other.value),
       variable_name(other.variable_name),
-      type(other.type),
-      node_left(other.node_left ? std::make_shared<Expression>(*other.node_left) : nullptr),
-      node_right(other.node_right ? std::make_shared<Expression>(*other.node_right) : nullptr) {}
+      node_left(other.node_left),
+      node_right(other.node_right),
+      type(other.type) {
+    EXPRESSION_COUNT(copies);
+}
 
 template <typename T>
 Expression<T>& Expression<T>::operator=(const Expression& other) {
+    EXPRESSION_COUNT(copies);
     if (this != &other) {
         value = other.value;
         variable_name = other.variable_name;
         type = other.type;
-        node_left = other.node_left ? std::make_shared<Expression>(*other.node_left) : nullptr;
-        node_right = other.node_right ? std::make_shared<Expression>(*other.node_right) : nullptr;
+        node_left = other.node_left;
+        node_right = other.node_right;
     }
     return *this;
 }
 
 template <typename T>
-Expression<T> Expression<T>::parse(const std::string& expr) {
+bool Expression<T>::NodeKey::operator==(const NodeKey& other) const {
+    if (type != other.type || left != other.left || right != other.right) {
+        return false;
+    }
+    if (type == Type::Number) {
+        return std::memcmp(&value, &other.value, sizeof(T)) == 0;
+    }
+    return variable_name == other.variable_name;
+}
+
+template <typename T>
+size_t Expression<T>::NodeKeyHash::operator()(const NodeKey& key) const {
+    size_t hash = std::hash<int>()(static_cast<int>(key.type));
+    auto combine = [&hash](size_t part) {
+        hash ^= part + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    };
+    combine(std::hash<const void*>()(key.left));
+    combine(std::hash<const void*>()(key.right));
+    if (key.type == Type::Number) {
+        combine(std::hash<std::string_view>()(
+            std::string_view(reinterpret_cast<const char*>(&key.value), sizeof(T))));
+    } else if (key.type == Type::Variable) {
+        combine(std::hash<std::string>()(key.variable_name));
+    }
+    return hash;
+}
+
+template <typename T>
+void* Expression<T>::NodeArena::allocate(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (block_size == 0) {
+        const size_t align = alignof(std::max_align_t);
+        block_size = std::max((bytes + align - 1) / align * align, sizeof(void*));
+    }
+    if (bytes > block_size) {
+        return ::operator new(bytes);
+    }
+
+    EXPRESSION_COUNT(node_allocations);
+    stats.nodes_allocated++;
+    stats.live_nodes++;
+    if (!available) {
+        Chunk* chunk = spare ? spare : newChunk();
+        spare = nullptr;
+        link(chunk);
+    }
+    Chunk* chunk = available;
+    void* block;
+    if (chunk->free_list) {
+        block = chunk->free_list;
+        chunk->free_list = *static_cast<void**>(block);
+    } else {
+        block = chunk->cursor;
+        chunk->cursor += block_size;
+    }
+    chunk->live++;
+    if (!chunk->free_list && static_cast<size_t>(chunk->end - chunk->cursor) < block_size) {
+        unlink(chunk);
+    }
+    return block;
+}
+
+template <typename T>
+void Expression<T>::NodeArena::deallocate(void* block, size_t bytes) {
+    if (bytes > block_size) {
+        ::operator delete(block);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.nodes_released++;
+    stats.live_nodes--;
+    Chunk* chunk = reinterpret_cast<Chunk*>(reinterpret_cast<std::uintptr_t>(block) & ~(chunk_bytes - 1));
+    *static_cast<void**>(block) = chunk->free_list;
+    chunk->free_list = block;
+    if (--chunk->live > 0) {
+        if (!chunk->listed) {
+            link(chunk);
+        }
+        return;
+    }
+
+    if (chunk->listed) {
+        unlink(chunk);
+    }
+    if (!spare) {
+        resetChunk(chunk);
+        spare = chunk;
+        return;
+    }
+    chunk->~Chunk();
+    ::operator delete(static_cast<void*>(chunk), std::align_val_t(chunk_bytes));
+    stats.arena_chunks--;
+    stats.arena_bytes -= chunk_bytes;
+}
+
+template <typename T>
+typename Expression<T>::NodeArena::Chunk* Expression<T>::NodeArena::newChunk() {
+    void* memory = ::operator new(chunk_bytes, std::align_val_t(chunk_bytes));
+    Chunk* chunk = new (memory) Chunk();
+    resetChunk(chunk);
+    stats.arena_chunks++;
+    stats.arena_bytes += chunk_bytes;
+    stats.peak_arena_bytes = std::max(stats.peak_arena_bytes, stats.arena_bytes);
+    return chunk;
+}
+
+template <typename T>
+void Expression<T>::NodeArena::resetChunk(Chunk* chunk) {
+    const size_t align = alignof(std::max_align_t);
+    unsigned char* base = reinterpret_cast<unsigned char*>(chunk);
+    chunk->free_list = nullptr;
+    chunk->cursor = base + (sizeof(Chunk) + align - 1) / align * align;
+    chunk->end = base + chunk_bytes;
+}
+
+template <typename T>
+void Expression<T>::NodeArena::link(Chunk* chunk) {
+    chunk->prev = nullptr;
+    chunk->next = available;
+    if (available) {
+        available->prev = chunk;
+    }
+    available = chunk;
+    chunk->listed = true;
+}
+
+template <typename T>
+void Expression<T>::NodeArena::unlink(Chunk* chunk) {
+    if (chunk->prev) {
+        chunk->prev->next = chunk->next;
+    } else {
+        available = chunk->next;
+    }
+    if (chunk->next) {
+        chunk->next->prev = chunk->prev;
+    }
+    chunk->prev = chunk->next = nullptr;
+    chunk->listed = false;
+}
+
+template <typename T>
+typename Expression<T>::NodeArena& Expression<T>::nodeArena() {
+    // The arena and the intern table (nodeTable) are intentionally never
+    // destroyed: nodes owned by static expressions may be released after
+    // other statics are gone, and their destructors use both.
+    static NodeArena* arena = new NodeArena();
+    return *arena;
+}
+
+template <typename T>
+typename Expression<T>::AllocationStats Expression<T>::allocation_stats() {
+    AllocationStats result;
+    {
+        NodeArena& arena = nodeArena();
+        std::lock_guard<std::mutex> lock(arena.mutex);
+        result = arena.stats;
+    }
+    NodeTable& table = nodeTable();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    result.intern_hits = table.hits;
+    return result;
+}
+
+template <typename T>
+void Expression<T>::reset_allocation_stats() {
+    {
+        NodeArena& arena = nodeArena();
+        std::lock_guard<std::mutex> lock(arena.mutex);
+        arena.stats.nodes_allocated = 0;
+        arena.stats.nodes_released = 0;
+        arena.stats.peak_arena_bytes = arena.stats.arena_bytes;
+    }
+    NodeTable& table = nodeTable();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    table.hits = 0;
+}
+
+template <typename T>
+typename Expression<T>::NodeTable& Expression<T>::nodeTable() {
+    // Leaked for the same reason as nodeArena().
+    static NodeTable* table = new NodeTable();
+    return *table;
+}
+
+template <typename T>
+typename Expression<T>::NodeKey Expression<T>::keyOf(const Expression<T>& node) {
+    // Children are interned before their parents, so comparing child
+    // pointers is enough to compare whole subtrees.
+    return NodeKey{node.type, node.node_left.get(), node.node_right.get(),
+                   node.type == Type::Number ? node.value : T(), node.variable_name};
+}
+
+template <typename T>
+std::shared_ptr<const Expression<T>> Expression<T>::intern(Expression<T>&& node) {
+    NodeKey key = keyOf(node);
+    NodeTable& table = nodeTable();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    auto it = table.nodes.find(key);
+    if (it != table.nodes.end()) {
+        if (std::shared_ptr<const Expression<T>> existing = it->second.owner.lock()) {
+            table.hits++;
+            return existing;
+        }
+    }
+
+    std::shared_ptr<Expression<T>> created =
+        std::allocate_shared<Expression<T>>(ArenaAllocator<Expression<T>>(), std::move(node));
+    created->interned_ = true;
+    table.nodes.insert_or_assign(std::move(key), NodeEntry{created, created.get()});
+    return created;
+}
+
+// Requires table.mutex. A node that died while another thread re-interned
+// an equal one no longer owns the entry and leaves it alone.
+template <typename T>
+void Expression<T>::forget(NodeTable& table, const Expression<T>& node) {
+    auto it = table.nodes.find(keyOf(node));
+    if (it != table.nodes.end() && it->second.node == &node) {
+        table.nodes.erase(it);
+    }
+}
+
+// use_count() is only a relaxed read. Once it reports a single owner, the
+// acquire fence orders this thread after the other owners' last accesses,
+// the same way shared_ptr's own release path does before destroying a node.
+template <typename T>
+bool Expression<T>::soleOwner(const std::shared_ptr<const Expression<T>>& node) {
+    if (node.use_count() != 1) {
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return true;
+}
+
+template <typename T>
+Expression<T>::~Expression() {
+    // Leaves and moved-from values own nothing to release.
+    if (!interned_ && !node_left && !node_right) {
+        return;
+    }
+    // Set while this thread holds the table lock and takes a tree apart.
+    static thread_local bool tearing_down = false;
+    NodeTable& table = nodeTable();
+    if (tearing_down) {
+        if (interned_) {
+            forget(table, *this);
+        }
+        return;
+    }
+    const bool uniqueChild = soleOwner(node_left) || soleOwner(node_right);
+    if (!interned_ && !uniqueChild) {
+        return;
+    }
+
+    // Uniquely owned descendants are detached into a local list so that
+    // releasing a very deep tree does not recurse once per level. The lock
+    // keeps other threads from reviving a node while it is taken apart.
+    std::lock_guard<std::mutex> lock(table.mutex);
+    if (interned_) {
+        forget(table, *this);
+        interned_ = false;
+    }
+    if (!uniqueChild) {
+        return;
+    }
+    tearing_down = true;
+    std::vector<std::shared_ptr<const Expression<T>>> pending;
+    auto detach = [&pending](std::shared_ptr<const Expression<T>>& child) {
+        if (soleOwner(child)) {
+            pending.push_back(std::move(child));
+        }
+    };
+    detach(node_left);
+    detach(node_right);
+    while (!pending.empty()) {
+        std::shared_ptr<const Expression<T>> node = std::move(pending.back());
+        pending.pop_back();
+        // intern() creates nodes non-const, and this walk is now their only
+        // owner. Their entry is dropped while the key (child pointers) is
+        // still intact, then the children are taken.
+        Expression<T>& owned = const_cast<Expression<T>&>(*node);
+        if (owned.interned_) {
+            forget(table, owned);
+            owned.interned_ = false;
+        }
+        detach(owned.node_left);
+        detach(owned.node_right);
+    }
+    tearing_down = false;
+}
+
+template <typename T>
+Expression<T> Expression<T>::parse(std::string_view expr) {
+    // Shunting-yard over explicit operand/operator stacks. Precedence
+    // (lowest first): + -, * /, ^, unary minus; binary operators are left
+    // associative and unary minus applies to the following factor only.
+    enum class Op { Add, Sub, Mul, Div, Pow, Neg, Paren, Sin, Cos, Exp, Ln };
+    struct Pending {
+        Op op;
+        size_t offset;
+    };
+    auto precedence = [](Op op) {
+        switch (op) {
+            case Op::Add:
+            case Op::Sub:
+                return 1;
+            case Op::Mul:
+            case Op::Div:
+                return 2;
+            case Op::Pow:
+                return 3;
+            case Op::Neg:
+                return 4;
+            default:
+                return 0;
+        }
+    };
+
+    std::vector<Expression<T>> operands;
+    std::vector<Pending> operators;
+    std::unordered_map<std::string_view, Expression<T>> variables;
+
+    auto reduce = [&operands](Op op) {
+        Expression<T> right = std::move(operands.back());
+        operands.pop_back();
+        switch (op) {
+            case Op::Neg:
+                operands.emplace_back(Type::Subtraction, Expression<T>(T(0)), std::move(right));
+                return;
+            case Op::Sin:
+                operands.emplace_back(Type::Sin, std::move(right));
+                return;
+            case Op::Cos:
+                operands.emplace_back(Type::Cos, std::move(right));
+                return;
+            case Op::Exp:
+                operands.emplace_back(Type::Exp, std::move(right));
+                return;
+            case Op::Ln:
+                operands.emplace_back(Type::Ln, std::move(right));
+                return;
+            default:
+                break;
+        }
+        Type type = op == Op::Add ? Type::Addition
+                  : op == Op::Sub ? Type::Subtraction
+                  : op == Op::Mul ? Type::Multiplication
+                  : op == Op::Div ? Type::Division
+                  : Type::Exponentiation;
+        Expression<T> left = std::move(operands.back());
+        operands.back() = Expression<T>(type, std::move(left), std::move(right));
+    };
+
     size_t pos = 0;
-    return parseExpression(expr, pos);
+    bool expectOperand = true;
+    while (true) {
+        skipWhitespace(expr, pos);
+        if (pos >= expr.size()) {
+            break;
+        }
+        const char c = expr[pos];
+
+        if (expectOperand) {
+            if (c == '(') {
+                operators.push_back({Op::Paren, pos++});
+            } else if (c == '-') {
+                operators.push_back({Op::Neg, pos++});
+            } else if (std::isdigit(static_cast<unsigned char>(c)) || c == '.') {
+                operands.push_back(parseNumber(expr, pos));
+                expectOperand = false;
+            } else if (std::isalpha(static_cast<unsigned char>(c))) {
+                size_t start = pos;
+                while (pos < expr.size() && std::isalpha(static_cast<unsigned char>(expr[pos]))) {
+                    pos++;
+                }
+                std::string_view token = expr.substr(start, pos - start);
+                if (token == "sin" || token == "cos" || token == "exp" || token == "ln") {
+                    skipWhitespace(expr, pos);
+                    if (pos >= expr.size() || expr[pos] != '(') {
+                        throw parseError("Expected '(' after '" + std::string(token) + "'", pos);
+                    }
+                    Op function = token == "sin" ? Op::Sin : token == "cos" ? Op::Cos : token == "exp" ? Op::Exp : Op::Ln;
+                    operators.push_back({function, pos++});
+                } else {
+                    auto it = variables.find(token);
+                    if (it == variables.end()) {
+                        it = variables.emplace(token, Expression<T>(std::string(token))).first;
+                    }
+                    operands.push_back(it->second);
+                    expectOperand = false;
+                }
+            } else {
+                throw parseError("Unexpected character '" + std::string(1, c) + "'", pos);
+            }
+            continue;
+        }
+
+        if (c == ')') {
+            while (!operators.empty() && precedence(operators.back().op) > 0) {
+                reduce(operators.back().op);
+                operators.pop_back();
+            }
+            if (operators.empty()) {
+                throw parseError("Unexpected ')'", pos);
+            }
+            Op open = operators.back().op;
+            operators.pop_back();
+            if (open != Op::Paren) {
+                reduce(open);
+            }
+            pos++;
+            continue;
+        }
+
+        Op op;
+        switch (c) {
+            case '+': op = Op::Add; break;
+            case '-': op = Op::Sub; break;
+            case '*': op = Op::Mul; break;
+            case '/': op = Op::Div; break;
+            case '^': op = Op::Pow; break;
+            default:
+                throw parseError("Unexpected character '" + std::string(1, c) + "'", pos);
+        }
+        while (!operators.empty() && precedence(operators.back().op) >= precedence(op)) {
+            reduce(operators.back().op);
+            operators.pop_back();
+        }
+        operators.push_back({op, pos++});
+        expectOperand = true;
+    }
+
+    if (expectOperand) {
+        throw parseError("Unexpected end of expression", pos);
+    }
+    while (!operators.empty()) {
+        if (precedence(operators.back().op) == 0) {
+            throw parseError("Expected ')'", operators.back().offset);
+        }
+        reduce(operators.back().op);
+        operators.pop_back();
+    }
+    return std::move(operands.back());
 }
 
 template <typename T>
 Expression<T> Expression<T>::substitute(const std::string& var_name, const Expression& replacement) const {
-    if (type == Type::Variable) {
-        return (variable_name == var_name) ? replacement : *this;
-    } else if (type == Type::Number) {
-        return *this;
-    } else {
-        switch (type) {
+    auto never = [](const std::shared_ptr<const Expression<T>>&) { return false; };
+    return fold<Expression<T>>(*this, never, [&](const Expression<T>& node, Expression<T>* children) {
+        switch (node.type) {
+            case Type::Variable:
+                return node.variable_name == var_name ? replacement : node;
+
+            case Type::Number:
+                return node;
+
             case Type::Addition:
             case Type::Subtraction:
             case Type::Multiplication:
             case Type::Division:
-            case Type::Exponentiation: {
-                Expression new_left = node_left->substitute(var_name, replacement);
-                Expression new_right = node_right->substitute(var_name, replacement);
-                return Expression(type, new_left, new_right);
-            }
+            case Type::Exponentiation:
+                return Expression(node.type, std::move(children[0]), std::move(children[1]));
+
             case Type::Sin:
             case Type::Cos:
             case Type::Ln:
-            case Type::Exp: {
-                Expression new_left = node_left->substitute(var_name, replacement);
-                return Expression(type, new_left);
-            }
+            case Type::Exp:
+                return Expression(node.type, std::move(children[0]));
+
             default:
                 throw std::runtime_error("Unknown operation type during substitution");
         }
-    }
+    });
 }
 
 template <typename T>
@@ -139,344 +595,625 @@ Expression<T> Expression<T>::exp() const {
 }
 
 template <typename T>
-T Expression<T>::calculate() {
+T Expression<T>::calculate() const {
     std::unordered_map<std::string, T> x;
     return calculate(x);
 }
 
 template <typename T>
-T Expression<T>::calculate(std::unordered_map<std::string, T>& variables) {
-    switch (type) {
-        case Type::Number:
-            return value;
-
-        case Type::Variable:
-            if (variables.find(variable_name) != variables.end()) {
-                return variables[variable_name];
+T Expression<T>::calculate(const std::unordered_map<std::string, T>& variables) const {
+    // Same walk as CompiledExpression: the divisor is evaluated (and
+    // checked) before the dividend, other operands left to right. A child
+    // whose value is at hand (a leaf or a cached shared node) is used in
+    // place, so only the other children get a frame of their own.
+    struct Frame {
+        const Expression<T>* node;
+        bool shared;
+        int stage;
+    };
+    std::vector<Frame> stack;
+    std::vector<T> results;
+    std::unordered_map<const Expression<T>*, T> cache;
+    auto lookup = [&variables](const Expression<T>& node) {
+        auto it = variables.find(node.variable_name);
+        if (it == variables.end()) {
+            throw std::runtime_error("Variable not found: " + node.variable_name);
+        }
+        return it->second;
+    };
+    // Returns true if the value of the child is already on top of results.
+    auto visit = [&](const std::shared_ptr<const Expression<T>>& child) {
+        if (child->type == Type::Number) {
+            EXPRESSION_COUNT(evaluation_visits);
+            results.push_back(child->value);
+            return true;
+        }
+        if (child->type == Type::Variable) {
+            EXPRESSION_COUNT(evaluation_visits);
+            results.push_back(lookup(*child));
+            return true;
+        }
+        const bool isShared = shared(child);
+        if (isShared) {
+            auto it = cache.find(child.get());
+            if (it != cache.end()) {
+                results.push_back(it->second);
+                return true;
             }
-            throw std::runtime_error("Variable not found: " + variable_name);
-
-        case Type::Addition:
-            return node_left->calculate(variables) + node_right->calculate(variables);
-
-        case Type::Subtraction:
-            return node_left->calculate(variables) - node_right->calculate(variables);
+        }
+        EXPRESSION_COUNT(evaluation_visits);
+        stack.push_back({child.get(), isShared, 0});
+        return false;
+    };
+    auto pop = [&results]() {
+        T result = results.back();
+        results.pop_back();
+        return result;
+    };
+    auto finish = [&](const Frame& frame, T result) {
+        if (frame.shared) {
+            cache.emplace(frame.node, result);
+        }
+        results.push_back(result);
+        stack.pop_back();
+    };
 
-        case Type::Multiplication:
-            return node_left->calculate(variables) * node_right->calculate(variables);
+    EXPRESSION_COUNT(evaluation_visits);
+    if (type == Type::Number) {
+        return value;
+    }
+    if (type == Type::Variable) {
+        return lookup(*this);
+    }
+    stack.push_back({this, false, 0});
+    while (!stack.empty()) {
+        // visit() may push onto the stack, so the frame is updated before.
+        const Frame frame = stack.back();
+        const Expression<T>& node = *frame.node;
+        switch (node.type) {
+            case Type::Division:
+                if (frame.stage == 0) {
+                    stack.back().stage = 1;
+                    if (!visit(node.node_right)) {
+                        break;
+                    }
+                }
+                if (frame.stage <= 1) {
+                    if (results.back() == T(0)) {
+                        throw std::runtime_error("Division by zero");
+                    }
+                    stack.back().stage = 2;
+                    if (!visit(node.node_left)) {
+                        break;
+                    }
+                }
+                {
+                    T left = pop();
+                    T right = pop();
+                    finish(frame, left / right);
+                }
+                break;
 
-        case Type::Division:
-            if (node_right->calculate(variables) == T(0)) {
-                throw std::runtime_error("Division by zero");
-            }
-            return node_left->calculate(variables) / node_right->calculate(variables);
+            case Type::Addition:
+            case Type::Subtraction:
+            case Type::Multiplication:
+            case Type::Exponentiation:
+                if (frame.stage == 0) {
+                    stack.back().stage = 1;
+                    if (!visit(node.node_left)) {
+                        break;
+                    }
+                }
+                if (frame.stage <= 1) {
+                    stack.back().stage = 2;
+                    if (!visit(node.node_right)) {
+                        break;
+                    }
+                }
+                {
+                    T right = pop();
+                    T left = pop();
+                    finish(frame, node.type == Type::Addition         ? left + right
+                                  : node.type == Type::Subtraction    ? left - right
+                                  : node.type == Type::Multiplication ? left * right
+                                                                      : std::pow(left, right));
+                }
+                break;
 
-        case Type::Exponentiation:
-            return std::pow(node_left->calculate(variables), node_right->calculate(variables));
+            case Type::Sin:
+            case Type::Cos:
+            case Type::Ln:
+            case Type::Exp:
+                if (frame.stage == 0) {
+                    stack.back().stage = 1;
+                    if (!visit(node.node_left)) {
+                        break;
+                    }
+                }
+                if (node.type == Type::Ln) {
+                    const T& argument = results.back();
+                    if constexpr (std::is_same_v<T, std::complex<double>>) {
+                        if (std::norm(argument) == 0) {
+                            throw std::runtime_error("Logarithm of zero");
+                        }
+                    } else {
+                        if (argument <= 0) {
+                            throw std::runtime_error("Logarithm of non-positive number");
+                        }
+                    }
+                }
+                {
+                    T argument = pop();
+                    finish(frame, node.type == Type::Sin   ? std::sin(argument)
+                                  : node.type == Type::Cos ? std::cos(argument)
+                                  : node.type == Type::Ln  ? std::log(argument)
+                                                           : std::exp(argument));
+                }
+                break;
 
-        case Type::Sin:
-            return std::sin(node_left->calculate(variables));
+            default:
+                throw std::runtime_error("Unsupported operation type");
+        }
+    }
+    return results.back();
+}
 
-        case Type::Cos:
-            return std::cos(node_left->calculate(variables));
+template <typename T>
+bool Expression<T>::shared(const std::shared_ptr<const Expression<T>>& child) {
+    // Only nodes reachable through more than one parent are worth caching.
+    return child->type != Type::Number && child->type != Type::Variable && !soleOwner(child);
+}
 
-        case Type::Ln:
-            if constexpr (std::is_same_v<T, std::complex<double>>) {
-                if (std::norm(node_left->calculate(variables)) == 0) {
-                    throw std::runtime_error("Logarithm of zero");
-                }
-            } else {
-                if (node_left->calculate(variables) <= 0) {
-                    throw std::runtime_error("Logarithm of non-positive number");
-                }
+template <typename T>
+template <typename R, typename Share, typename Combine>
+R Expression<T>::fold(const Expression<T>& root, Share share, Combine combine) {
+    struct Frame {
+        const Expression<T>* node;
+        bool shared;
+        int stage;
+    };
+    std::vector<Frame> stack{{&root, false, 0}};
+    std::vector<R> results;
+    std::unordered_map<const Expression<T>*, R> cache;
+    // Returns true if the result of the child is already on top of results.
+    auto visit = [&](const std::shared_ptr<const Expression<T>>& child) {
+        if (!child->node_left) {
+            results.push_back(combine(*child, nullptr));
+            return true;
+        }
+        const bool isShared = share(child);
+        if (isShared) {
+            auto it = cache.find(child.get());
+            if (it != cache.end()) {
+                results.push_back(it->second);
+                return true;
+            }
+        }
+        stack.push_back({child.get(), isShared, 0});
+        return false;
+    };
+
+    while (!stack.empty()) {
+        // visit() may push onto the stack, so the frame is updated before.
+        const Frame frame = stack.back();
+        const Expression<T>& node = *frame.node;
+        if (frame.stage == 0 && node.node_left) {
+            stack.back().stage = 1;
+            if (!visit(node.node_left)) {
+                continue;
             }
-            return std::log(node_left->calculate(variables));
-            /*if (node_left->calculate(variables) <= 0) {
-                throw std::runtime_error("Logarithm of non-positive number");
+        }
+        if (frame.stage <= 1 && node.node_right) {
+            stack.back().stage = 2;
+            if (!visit(node.node_right)) {
+                continue;
             }
-            return std::log(node_left->calculate(variables));*/
-
-        case Type::Exp:
-            return std::exp(node_left->calculate(variables));
+        }
 
-        default:
-            throw std::runtime_error("Unsupported operation type");
+        stack.pop_back();
+        const size_t arity = (node.node_left ? 1 : 0) + (node.node_right ? 1 : 0);
+        R result = combine(node, results.data() + (results.size() - arity));
+        results.erase(results.end() - arity, results.end());
+        if (frame.shared) {
+            cache.emplace(frame.node, result);
+        }
+        results.push_back(std::move(result));
     }
+    return std::move(results.back());
 }
 
 template <typename T>
-std::string Expression<T>::to_string() {
-    switch (type) {
-        case Type::Number:
-            if constexpr (std::is_same_v<T, std::complex<double>>) {
-                std::ostringstream oss;
-                oss << value.real();
-                if (value.imag() != 0) {
-                    oss << (value.imag() > 0 ? "+" : "") << value.imag() << "i";
+std::string Expression<T>::to_string() const {
+    // In-order walk with an explicit stack that appends to a single string,
+    // so both the depth and the output length only cost memory.
+    struct Frame {
+        const Expression<T>* node;
+        int stage;
+    };
+    std::vector<Frame> stack{{this, 0}};
+    std::string out;
+
+    while (!stack.empty()) {
+        const Expression<T>& node = *stack.back().node;
+        const int stage = stack.back().stage;
+        switch (node.type) {
+            case Type::Number:
+                if constexpr (std::is_same_v<T, std::complex<double>>) {
+                    std::ostringstream oss;
+                    oss << node.value.real();
+                    if (node.value.imag() != 0) {
+                        oss << (node.value.imag() > 0 ? "+" : "") << node.value.imag() << "i";
+                    }
+                    out += oss.str();
+                } else {
+                    out += std::to_string(node.value);
                 }
-                return oss.str();
-            } else {
-                return std::to_string(value);
-            }
+                stack.pop_back();
+                break;
 
-        case Type::Variable:
-            return variable_name;
+            case Type::Variable:
+                out += node.variable_name;
+                stack.pop_back();
+                break;
 
-        case Type::Addition:
-            return "(" + node_left->to_string() + " + " + node_right->to_string() + ")";
-
-        case Type::Subtraction:
-            return "(" + node_left->to_string() + " - " + node_right->to_string() + ")";
-
-        case Type::Multiplication:
-            return "(" + node_left->to_string() + " * " + node_right->to_string() + ")";
-
-        case Type::Division:
-            return "(" + node_left->to_string() + " / " + node_right->to_string() + ")";
-
-        case Type::Exponentiation:
-            return "(" + node_left->to_string() + " ^ " + node_right->to_string() + ")";
-
-        case Type::Sin:
-            return "sin(" + node_left->to_string() + ")";
-
-        case Type::Cos:
-            return "cos(" + node_left->to_string() + ")";
-
-        case Type::Exp:
-            return "exp(" + node_left->to_string() + ")";
+            case Type::Addition:
+            case Type::Subtraction:
+            case Type::Multiplication:
+            case Type::Division:
+            case Type::Exponentiation:
+                if (stage == 0) {
+                    out += "(";
+                    stack.back().stage = 1;
+                    stack.push_back({node.node_left.get(), 0});
+                } else if (stage == 1) {
+                    out += node.type == Type::Addition         ? " + "
+                           : node.type == Type::Subtraction    ? " - "
+                           : node.type == Type::Multiplication ? " * "
+                           : node.type == Type::Division       ? " / "
+                                                               : " ^ ";
+                    stack.back().stage = 2;
+                    stack.push_back({node.node_right.get(), 0});
+                } else {
+                    out += ")";
+                    stack.pop_back();
+                }
+                break;
 
-        case Type::Ln:
-            return "ln(" + node_left->to_string() + ")";
+            case Type::Sin:
+            case Type::Cos:
+            case Type::Exp:
+            case Type::Ln:
+                if (stage == 0) {
+                    out += node.type == Type::Sin   ? "sin("
+                           : node.type == Type::Cos ? "cos("
+                           : node.type == Type::Exp ? "exp("
+                                                    : "ln(";
+                    stack.back().stage = 1;
+                    stack.push_back({node.node_left.get(), 0});
+                } else {
+                    out += ")";
+                    stack.pop_back();
+                }
+                break;
 
-        default:
-            throw std::runtime_error("Unsupported operation type");
+            default:
+                throw std::runtime_error("Unsupported operation type");
+        }
     }
+    return out;
 }
 
 template <typename T>
 Expression<T> Expression<T>::differentiate(const std::string& var_name) const {
-    switch (type) {
-        case Type::Number:
-            return Expression<T>(T(0));
+    // A shared subexpression is differentiated once per call, which keeps
+    // the work linear in the number of distinct nodes.
+    return fold<Expression<T>>(*this, shared, [&var_name](const Expression<T>& node, Expression<T>* d) {
+        const Expression<T>* left = node.node_left.get();
+        const Expression<T>* right = node.node_right.get();
+        switch (node.type) {
+            case Type::Number:
+                return Expression<T>(T(0));
+
+            case Type::Variable:
+                return Expression<T>(node.variable_name == var_name ? 1 : 0);
 
-        case Type::Variable:
-            return Expression<T>(variable_name == var_name ? 1 : 0);
+            case Type::Addition:
+                return d[0] + d[1];
 
-        case Type::Addition:
-            return node_left->differentiate(var_name) + node_right->differentiate(var_name);
+            case Type::Subtraction:
+                return d[0] - d[1];
 
-        case Type::Subtraction:
-            return node_left->differentiate(var_name) - node_right->differentiate(var_name);
+            case Type::Multiplication:
+                return (d[0] * (*right)) + ((*left) * d[1]);
 
-        case Type::Multiplication:
-            return (node_left->differentiate(var_name) * (*node_right)) +
-                   ((*node_left) * node_right->differentiate(var_name));
+            case Type::Division:
+                return (d[0] * (*right) - ((*left) * d[1])) / ((*right) ^ Expression<T>(2));
 
-        case Type::Division:
-            return (node_left->differentiate(var_name) * (*node_right) -
-                   ((*node_left) * node_right->differentiate(var_name))) /
-                   ((*node_right) ^ Expression<T>(2));
+            case Type::Exponentiation:
+                return ((*left) ^ (*right)) * (d[1] * left->ln() + ((*right) * d[0]) / (*left));
 
-        case Type::Exponentiation:
-            return ((*node_left) ^ (*node_right)) *
-                   (node_right->differentiate(var_name) * node_left->ln() +
-                    ((*node_right) * node_left->differentiate(var_name)) / (*node_left));
+            case Type::Sin:
+                return left->cos() * d[0];
 
-        case Type::Sin:
-            return node_left->cos() * node_left->differentiate(var_name);
+            case Type::Cos:
+                return Expression<T>(-1) * left->sin() * d[0];
 
-        case Type::Cos:
-            return Expression<T>(-1) * node_left->sin() * node_left->differentiate(var_name);
+            case Type::Ln:
+                return d[0] / (*left);
 
-        case Type::Ln:
-            return node_left->differentiate(var_name) / (*node_left);
+            case Type::Exp:
+                return left->exp() * d[0];
 
-        case Type::Exp:
-            return node_left->exp() * node_left->differentiate(var_name);
+            default:
+                throw std::runtime_error("Unsupported operation for differentiation");
+        }
+    });
+}
 
-        default:
-            throw std::runtime_error("Unsupported operation for differentiation");
-    }
+template <typename T>
+Expression<T> Expression<T>::differentiate(const std::string& var_name, bool simplify_result) const {
+    Expression<T> derivative = differentiate(var_name);
+    return simplify_result ? derivative.simplify() : derivative;
 }
 
 template <typename T>
-Expression<T> Expression<T>::parseExpression(const std::string& expr, size_t& pos) {
-    Expression<T> left = parseTerm(expr, pos);
-    while (pos < expr.size()) {
-        skipWhitespace(expr, pos);
-        char op = expr[pos];
-        if (op == '+' || op == '-') {
-            pos++;
-            Expression<T> right = parseTerm(expr, pos);
-            if (op == '+') {
-                left = left + right;
-            } else {
-                left = left - right;
-            }
-        } else {
-            break;
-        }
-    }
-    return left;
+bool Expression<T>::isNumber(T number) const {
+    return type == Type::Number && value == number;
 }
 
 template <typename T>
-Expression<T> Expression<T>::parseTerm(const std::string& expr, size_t& pos) {
-    Expression<T> left = parsePower(expr, pos);
-    while (pos < expr.size()) {
-        skipWhitespace(expr, pos);
-        char op = expr[pos];
-        if (op == '*' || op == '/') {
-            pos++;
-            Expression<T> right = parsePower(expr, pos);
-            if (op == '*') {
-                left = left * right;
-            } else {
-                left = left / right;
-            }
-        } else {
-            break;
-        }
+bool Expression<T>::sameNode(const Expression<T>& other) const {
+    if (type != other.type || node_left != other.node_left || node_right != other.node_right) {
+        return false;
     }
-    return left;
+    if (type == Type::Number) {
+        return std::memcmp(&value, &other.value, sizeof(T)) == 0;
+    }
+    return variable_name == other.variable_name;
 }
 
 template <typename T>
-Expression<T> Expression<T>::parsePower(const std::string& expr, size_t& pos) {
-    Expression<T> left = parseFactor(expr, pos);
-    while (pos < expr.size()) {
-        skipWhitespace(expr, pos);
-        char op = expr[pos];
-        if (op == '^') {
-            pos++;
-            Expression<T> right = parseFactor(expr, pos);
-            left = left ^ right;
-        } else {
-            break;
+size_t Expression<T>::node_count() const {
+    std::unordered_map<const Expression<T>*, bool> visited;
+    std::vector<const Expression<T>*> pending{this};
+    while (!pending.empty()) {
+        const Expression<T>* node = pending.back();
+        pending.pop_back();
+        if (!visited.emplace(node, true).second) {
+            continue;
+        }
+        if (node->node_left) {
+            pending.push_back(node->node_left.get());
+        }
+        if (node->node_right) {
+            pending.push_back(node->node_right.get());
         }
     }
-    return left;
+    return visited.size();
 }
 
 template <typename T>
-Expression<T> Expression<T>::parseFactor(const std::string& expr, size_t& pos) {
-    skipWhitespace(expr, pos);
-    if (pos >= expr.size()) {
-        throw std::runtime_error("Unexpected end of expression");
+Expression<T> Expression<T>::simplify(SimplifyReport* report) const {
+    Expression<T> current = *this;
+    size_t passes = 0;
+    bool changed = true;
+    while (changed && passes < 64) {
+        Expression<T> next = current.simplifyOnce();
+        changed = !next.sameNode(current);
+        current = std::move(next);
+        passes++;
     }
-
-    if (expr[pos] == '(') {
-        pos++;
-        Expression<T> result = parseExpression(expr, pos);
-        skipWhitespace(expr, pos);
-        if (pos >= expr.size() || expr[pos] != ')') {
-            throw std::runtime_error("Expected ')'");
-        }
-        pos++;
-        return result;
+    if (report) {
+        report->nodes_before = node_count();
+        report->nodes_after = current.node_count();
+        report->passes = passes;
     }
+    return current;
+}
 
-    if (isdigit(expr[pos]) || expr[pos] == '.') {
-        return parseNumber(expr, pos);
-    }
+template <typename T>
+Expression<T> Expression<T>::simplifyOnce() const {
+    auto always = [](const std::shared_ptr<const Expression<T>>&) { return true; };
+    return fold<Expression<T>>(*this, always, [](const Expression<T>& node, Expression<T>* children) {
+        switch (node.type) {
+            case Type::Number:
+            case Type::Variable:
+                return node;
 
-    if (isalpha(expr[pos])) {
-        return parseFunctionOrVariable(expr, pos);
-    }
+            case Type::Addition:
+            case Type::Subtraction:
+            case Type::Multiplication:
+            case Type::Division:
+            case Type::Exponentiation:
+                return rewrite(node.type, std::move(children[0]), std::move(children[1]));
 
-    if (expr[pos] == '-') {
-        pos++;
-        return Expression<T>(Type::Subtraction, Expression<T>(T(0)), parseFactor(expr, pos));
-    }
+            case Type::Sin:
+            case Type::Cos:
+            case Type::Ln:
+            case Type::Exp:
+                return rewrite(node.type, std::move(children[0]));
 
-    throw std::runtime_error("Unexpected character: " + std::string(1, expr[pos]));
+            default:
+                throw std::runtime_error("Unsupported operation type during simplification");
+        }
+    });
 }
 
 template <typename T>
-Expression<T> Expression<T>::parseNumber(const std::string& expr, size_t& pos) {
-    size_t start = pos;
-    while (pos < expr.size() && (isdigit(expr[pos]) || expr[pos] == '.')) {
-        pos++;
+Expression<T> Expression<T>::rewrite(Type op, Expression<T> a, Expression<T> b) {
+    if (a.type == Type::Number && b.type == Type::Number) {
+        Expression<T> folded(op, std::move(a), std::move(b));
+        try {
+            return Expression<T>(folded.calculate());
+        } catch (const std::runtime_error&) {
+            return folded;
+        }
     }
-    std::string numStr = expr.substr(start, pos - start);
-    return Expression<T>(static_cast<T>(std::stod(numStr)));
-}
 
-template <typename T>
-Expression<T> Expression<T>::parseFunctionOrVariable(const std::string& expr, size_t& pos) {
-    size_t start = pos;
-    while (pos < expr.size() && isalpha(expr[pos])) {
-        pos++;
-    }
-    std::string token = expr.substr(start, pos - start);
+    // (-1) * x is the canonical negation, as produced by differentiate().
+    auto isNegation = [](const Expression<T>& e) {
+        return e.type == Type::Multiplication && e.node_left->isNumber(T(-1));
+    };
 
-    if (token == "sin") {
-        skipWhitespace(expr, pos);
-        if (expr[pos] != '(') {
-            throw std::runtime_error("Expected '(' after 'sin'");
-        }
-        pos++;
-        Expression<T> arg = parseExpression(expr, pos);
-        skipWhitespace(expr, pos);
-        if (expr[pos] != ')') {
-            throw std::runtime_error("Expected ')' after sin argument");
-        }
-        pos++;
-        return arg.sin();
+    switch (op) {
+        case Type::Addition:
+            if (a.isNumber(T(0))) {
+                return b;
+            }
+            if (b.isNumber(T(0))) {
+                return a;
+            }
+            if (a.sameNode(b)) {
+                return rewrite(Type::Multiplication, Expression<T>(T(2)), std::move(a));
+            }
+            if (isNegation(b)) {
+                return rewrite(Type::Subtraction, std::move(a), *b.node_right);
+            }
+            if (isNegation(a)) {
+                return rewrite(Type::Subtraction, std::move(b), *a.node_right);
+            }
+            break;
+
+        case Type::Subtraction:
+            if (b.isNumber(T(0))) {
+                return a;
+            }
+            if (a.isNumber(T(0))) {
+                return rewrite(Type::Multiplication, Expression<T>(T(-1)), std::move(b));
+            }
+            if (a.sameNode(b)) {
+                return Expression<T>(T(0));
+            }
+            if (isNegation(b)) {
+                return rewrite(Type::Addition, std::move(a), *b.node_right);
+            }
+            break;
+
+        case Type::Multiplication:
+            if (a.isNumber(T(0)) || b.isNumber(T(0))) {
+                return Expression<T>(T(0));
+            }
+            if (a.isNumber(T(1))) {
+                return b;
+            }
+            if (b.isNumber(T(1))) {
+                return a;
+            }
+            // Constant factors are hoisted to the left and merged.
+            if (b.type == Type::Number) {
+                return rewrite(Type::Multiplication, std::move(b), std::move(a));
+            }
+            if (a.type == Type::Number && b.type == Type::Multiplication && b.node_left->type == Type::Number) {
+                return rewrite(Type::Multiplication, rewrite(Type::Multiplication, std::move(a), *b.node_left),
+                               *b.node_right);
+            }
+            if (a.type == Type::Multiplication && a.node_left->type == Type::Number) {
+                return rewrite(Type::Multiplication, *a.node_left,
+                               rewrite(Type::Multiplication, *a.node_right, std::move(b)));
+            }
+            if (a.type != Type::Number && b.type == Type::Multiplication && b.node_left->type == Type::Number) {
+                return rewrite(Type::Multiplication, *b.node_left,
+                               rewrite(Type::Multiplication, std::move(a), *b.node_right));
+            }
+            // (x ^ c) * (d / x) -> d * x ^ (c - 1): the power rule, so that
+            // derivatives of integer powers do not go through ln.
+            if (a.type == Type::Exponentiation && a.node_right->type == Type::Number &&
+                b.type == Type::Division && b.node_right == a.node_left) {
+                return rewrite(Type::Multiplication, *b.node_left,
+                               rewrite(Type::Exponentiation, *a.node_left,
+                                       Expression<T>(a.node_right->value - T(1))));
+            }
+            break;
+
+        case Type::Division:
+            if (b.isNumber(T(1))) {
+                return a;
+            }
+            if (a.isNumber(T(0)) && b.type != Type::Number) {
+                return Expression<T>(T(0));
+            }
+            if (a.type == Type::Multiplication && a.node_left->type == Type::Number) {
+                return rewrite(Type::Multiplication, *a.node_left,
+                               rewrite(Type::Division, *a.node_right, std::move(b)));
+            }
+            break;
+
+        case Type::Exponentiation:
+            if (b.isNumber(T(1))) {
+                return a;
+            }
+            if (b.isNumber(T(0)) || a.isNumber(T(1))) {
+                return Expression<T>(T(1));
+            }
+            break;
+
+        default:
+            break;
     }
+    return Expression<T>(op, std::move(a), std::move(b));
+}
 
-    if (token == "cos") {
-        skipWhitespace(expr, pos);
-        if (expr[pos] != '(') {
-            throw std::runtime_error("Expected '(' after 'cos'");
-        }
-        pos++;
-        Expression<T> arg = parseExpression(expr, pos);
-        skipWhitespace(expr, pos);
-        if (expr[pos] != ')') {
-            throw std::runtime_error("Expected ')' after cos argument");
+template <typename T>
+Expression<T> Expression<T>::rewrite(Type op, Expression<T> a) {
+    if (a.type == Type::Number) {
+        Expression<T> folded(op, std::move(a));
+        try {
+            return Expression<T>(folded.calculate());
+        } catch (const std::runtime_error&) {
+            return folded;
         }
-        pos++;
-        return arg.cos();
     }
 
-    if (token == "exp") {
-        skipWhitespace(expr, pos);
-        if (expr[pos] != '(') {
-            throw std::runtime_error("Expected '(' after 'exp'");
-        }
-        pos++;
-        Expression<T> arg = parseExpression(expr, pos);
-        skipWhitespace(expr, pos);
-        if (expr[pos] != ')') {
-            throw std::runtime_error("Expected ')' after exp argument");
-        }
-        pos++;
-        return arg.exp();
+    bool negated = a.type == Type::Multiplication && a.node_left->isNumber(T(-1));
+    switch (op) {
+        case Type::Sin:
+            if (negated) {
+                return rewrite(Type::Multiplication, Expression<T>(T(-1)), Expression<T>(Type::Sin, *a.node_right));
+            }
+            break;
+
+        case Type::Cos:
+            if (negated) {
+                return Expression<T>(Type::Cos, *a.node_right);
+            }
+            break;
+
+        case Type::Ln:
+            if constexpr (std::is_floating_point_v<T>) {
+                if (a.type == Type::Exp) {
+                    return *a.node_left;
+                }
+            }
+            break;
+
+        default:
+            break;
     }
+    return Expression<T>(op, std::move(a));
+}
 
-    if (token == "ln") {
-        skipWhitespace(expr, pos);
-        if (expr[pos] != '(') {
-            throw std::runtime_error("Expected '(' after 'ln'");
-        }
-        pos++;
-        Expression<T> arg = parseExpression(expr, pos);
-        skipWhitespace(expr, pos);
-        if (expr[pos] != ')') {
-            throw std::runtime_error("Expected ')' after ln argument");
-        }
+template <typename T>
+std::runtime_error Expression<T>::parseError(const std::string& message, size_t offset) {
+    return std::runtime_error(message + " at offset " + std::to_string(offset));
+}
+
+template <typename T>
+Expression<T> Expression<T>::parseNumber(std::string_view expr, size_t& pos) {
+    size_t start = pos;
+    while (pos < expr.size() && (std::isdigit(static_cast<unsigned char>(expr[pos])) || expr[pos] == '.')) {
         pos++;
-        return arg.ln();
     }
-
-    return Expression<T>(token);
+    double number = 0;
+    auto [end, ec] = std::from_chars(expr.data() + start, expr.data() + pos, number);
+    if (ec != std::errc() || end != expr.data() + pos) {
+        throw parseError("Invalid number '" + std::string(expr.substr(start, pos - start)) + "'", start);
+    }
+    return Expression<T>(static_cast<T>(number));
 }
 
 template <typename T>
-void Expression<T>::skipWhitespace(const std::string& expr, size_t& pos) {
-    while (pos < expr.size() && isspace(expr[pos])) {
+void Expression<T>::skipWhitespace(std::string_view expr, size_t& pos) {
+    while (pos < expr.size() && std::isspace(static_cast<unsigned char>(expr[pos]))) {
         pos++;
     }
 }
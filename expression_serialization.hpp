@@ -0,0 +1,141 @@
+#ifndef EXPRESSION_SERIALIZATION_HPP
+#define EXPRESSION_SERIALIZATION_HPP
+
+#include <complex>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "expression.hpp"
+
+// Binary form of one or more expressions (e.g. a function and its
+// derivatives), shared nodes stored once. All integers are host-endian
+// uint32; sections follow the header in this order:
+//
+//     header      serialized::Header
+//     constants   T[constant_count]
+//     nodes       serialized::Node[node_count], children before parents
+//     roots       serialized::Root[root_count]
+//     schedule    uint32[schedule_length]
+//     strings     uint32[string_count + 1] offsets, then the characters
+//
+// Strings [0, variable_count) are the variable names, so a Variable node's
+// lhs is both its string index and its value slot; root labels follow.
+// Each root owns a slice of the schedule listing its nodes in calculate()
+// order, with serialized::check_divisor marking the divisor checks, so a
+// loaded root evaluates with one pass and fails exactly like calculate().
+namespace serialized {
+
+constexpr char magic[8] = {'E', 'X', 'P', 'R', 'T', 'R', 'E', 'E'};
+constexpr std::uint32_t version = 1;
+constexpr std::uint32_t byte_order = 0x01020304;
+constexpr std::uint32_t check_divisor = 0x80000000u;
+
+struct Header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint32_t value_type;
+    std::uint32_t value_size;
+    std::uint32_t constant_count;
+    std::uint32_t node_count;
+    std::uint32_t root_count;
+    std::uint32_t schedule_length;
+    std::uint32_t variable_count;
+    std::uint32_t string_count;
+    std::uint32_t string_bytes;
+    std::uint32_t reserved;
+};
+
+// type is the Expression<T>::Type value. Number: lhs indexes the constants;
+// Variable: lhs is the variable slot; unary nodes use lhs only.
+struct Node {
+    std::uint8_t type;
+    std::uint8_t reserved[3];
+    std::uint32_t lhs;
+    std::uint32_t rhs;
+};
+
+struct Root {
+    std::uint32_t node;
+    std::uint32_t label;
+    std::uint32_t schedule_begin;
+    std::uint32_t schedule_end;
+};
+
+template <typename T>
+constexpr std::uint32_t value_type() {
+    static_assert(std::is_same_v<T, double> || std::is_same_v<T, std::complex<double>>,
+                  "Serialization supports double and std::complex<double>");
+    return std::is_same_v<T, double> ? 1 : 2;
+}
+
+// True if the file at path holds complex values (used to pick T).
+inline bool is_complex(const std::string& path);
+
+}  // namespace serialized
+
+template <typename T>
+std::string serialize_expressions(const std::vector<std::pair<std::string, Expression<T>>>& roots);
+
+template <typename T>
+void save_expressions(const std::string& path, const std::vector<std::pair<std::string, Expression<T>>>& roots);
+
+// Read-only memory mapping of a serialized file. Evaluation reads nodes and
+// constants straight from the mapping; the only memory it needs is one
+// register per node, allocated once.
+template <typename T>
+class MappedExpressions {
+public:
+    explicit MappedExpressions(const std::string& path);
+    ~MappedExpressions();
+
+    MappedExpressions(const MappedExpressions&) = delete;
+    MappedExpressions& operator=(const MappedExpressions&) = delete;
+
+    size_t root_count() const;
+    std::string_view label(size_t root) const;
+    size_t root(std::string_view label) const;
+
+    size_t variable_count() const;
+    std::string_view variable(size_t slot) const;
+    size_t slot(std::string_view name) const;
+
+    size_t node_count() const;
+
+    // values[slot] holds the binding of variable(slot); registers must have
+    // room for node_count() values.
+    T evaluate(size_t root, const T* values);
+    T evaluate(size_t root, const T* values, T* registers) const;
+
+    T calculate(size_t root, const std::unordered_map<std::string, T>& variables);
+
+    // Rebuilds the tree, e.g. to print or differentiate it further.
+    Expression<T> expression(size_t root) const;
+
+private:
+    using Type = typename Expression<T>::Type;
+
+    void* mapping_ = nullptr;
+    size_t size_ = 0;
+    serialized::Header header_{};
+    const T* constants_ = nullptr;
+    const serialized::Node* nodes_ = nullptr;
+    const serialized::Root* roots_ = nullptr;
+    const std::uint32_t* schedule_ = nullptr;
+    const std::uint32_t* string_offsets_ = nullptr;
+    const char* strings_ = nullptr;
+    std::vector<T> registers_;
+    std::vector<T> bindings_;
+
+    void validate() const;
+    std::string_view string(std::uint32_t index) const;
+    const serialized::Root& rootAt(size_t root) const;
+};
+
+#include "expression_serialization.tpp"
+
+#endif
@@ -0,0 +1,487 @@
+#ifndef EXPRESSION_SERIALIZATION_TPP
+#define EXPRESSION_SERIALIZATION_TPP
+
+#include "expression_serialization.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include "compiled_expression.hpp"
+
+namespace serialized {
+
+struct Layout {
+    std::uint64_t constants;
+    std::uint64_t nodes;
+    std::uint64_t roots;
+    std::uint64_t schedule;
+    std::uint64_t string_offsets;
+    std::uint64_t strings;
+    std::uint64_t end;
+};
+
+inline Layout layout(const Header& header) {
+    Layout result;
+    result.constants = sizeof(Header);
+    result.nodes = result.constants + std::uint64_t(header.constant_count) * header.value_size;
+    result.roots = result.nodes + std::uint64_t(header.node_count) * sizeof(Node);
+    result.schedule = result.roots + std::uint64_t(header.root_count) * sizeof(Root);
+    result.string_offsets = result.schedule + std::uint64_t(header.schedule_length) * sizeof(std::uint32_t);
+    result.strings = result.string_offsets + (std::uint64_t(header.string_count) + 1) * sizeof(std::uint32_t);
+    result.end = result.strings + header.string_bytes;
+    return result;
+}
+
+inline bool is_complex(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    Header header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        throw std::runtime_error("Cannot read serialized expressions: " + path);
+    }
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0) {
+        throw std::runtime_error("Not a serialized expression file: " + path);
+    }
+    return header.value_type == value_type<std::complex<double>>();
+}
+
+}  // namespace serialized
+
+template <typename T>
+std::string serialize_expressions(const std::vector<std::pair<std::string, Expression<T>>>& roots) {
+    using Type = typename Expression<T>::Type;
+
+    std::vector<T> constants;
+    std::vector<serialized::Node> nodes;
+    std::vector<serialized::Root> records;
+    std::vector<std::uint32_t> schedule;
+    std::vector<std::string> strings;
+    std::unordered_map<std::string, std::uint32_t> slots;
+    std::unordered_map<const Expression<T>*, std::uint32_t> indices;
+
+    auto checkedIndex = [](size_t size) {
+        if (size >= serialized::check_divisor) {
+            throw std::runtime_error("Expression too large to serialize");
+        }
+        return static_cast<std::uint32_t>(size);
+    };
+
+    // Same walk as CompiledExpression: operands in calculate() order, the
+    // divisor (and its check) before the dividend. Node indices are shared
+    // by all roots; every root schedules each reachable node once.
+    struct Frame {
+        const Expression<T>* node;
+        int stage;
+    };
+    for (const auto& [label, expr] : roots) {
+        serialized::Root record{};
+        record.schedule_begin = checkedIndex(schedule.size());
+        std::unordered_map<const Expression<T>*, bool> scheduled;
+        std::vector<Frame> stack{{&expr, 0}};
+        while (!stack.empty()) {
+            const Expression<T>* node = stack.back().node;
+            const int stage = stack.back().stage;
+            if (stage == 0 && scheduled.count(node)) {
+                stack.pop_back();
+                continue;
+            }
+            const bool division = node->type == Type::Division;
+            const Expression<T>* first = division ? node->node_right.get() : node->node_left.get();
+            const Expression<T>* second = division ? node->node_left.get() : node->node_right.get();
+            if (stage == 0 && first) {
+                stack.back().stage = 1;
+                stack.push_back({first, 0});
+                continue;
+            }
+            if (stage == 1 && second) {
+                if (division) {
+                    schedule.push_back(indices.at(first) | serialized::check_divisor);
+                }
+                stack.back().stage = 2;
+                stack.push_back({second, 0});
+                continue;
+            }
+            stack.pop_back();
+            scheduled.emplace(node, true);
+
+            auto it = indices.find(node);
+            if (it == indices.end()) {
+                serialized::Node out{};
+                out.type = static_cast<std::uint8_t>(node->type);
+                if (node->type == Type::Number) {
+                    out.lhs = checkedIndex(constants.size());
+                    constants.push_back(node->value);
+                } else if (node->type == Type::Variable) {
+                    auto slot = slots.find(node->variable_name);
+                    if (slot == slots.end()) {
+                        slot = slots.emplace(node->variable_name, checkedIndex(strings.size())).first;
+                        strings.push_back(node->variable_name);
+                    }
+                    out.lhs = slot->second;
+                } else {
+                    out.lhs = indices.at(node->node_left.get());
+                    out.rhs = node->node_right ? indices.at(node->node_right.get()) : 0;
+                }
+                it = indices.emplace(node, checkedIndex(nodes.size())).first;
+                nodes.push_back(out);
+            }
+            schedule.push_back(it->second);
+        }
+        record.node = indices.at(&expr);
+        record.schedule_end = checkedIndex(schedule.size());
+        records.push_back(record);
+    }
+
+    const size_t variableCount = strings.size();
+    for (size_t i = 0; i < roots.size(); ++i) {
+        records[i].label = checkedIndex(strings.size());
+        strings.push_back(roots[i].first);
+    }
+    std::vector<std::uint32_t> stringOffsets{0};
+    for (const std::string& s : strings) {
+        stringOffsets.push_back(checkedIndex(stringOffsets.back() + s.size()));
+    }
+
+    serialized::Header header{};
+    std::memcpy(header.magic, serialized::magic, sizeof(header.magic));
+    header.version = serialized::version;
+    header.byte_order = serialized::byte_order;
+    header.value_type = serialized::value_type<T>();
+    header.value_size = sizeof(T);
+    header.constant_count = checkedIndex(constants.size());
+    header.node_count = checkedIndex(nodes.size());
+    header.root_count = checkedIndex(records.size());
+    header.schedule_length = checkedIndex(schedule.size());
+    header.variable_count = checkedIndex(variableCount);
+    header.string_count = checkedIndex(strings.size());
+    header.string_bytes = stringOffsets.back();
+
+    std::string out;
+    out.reserve(serialized::layout(header).end);
+    auto append = [&out](const void* data, size_t size) {
+        out.append(static_cast<const char*>(data), size);
+    };
+    append(&header, sizeof(header));
+    append(constants.data(), constants.size() * sizeof(T));
+    append(nodes.data(), nodes.size() * sizeof(serialized::Node));
+    append(records.data(), records.size() * sizeof(serialized::Root));
+    append(schedule.data(), schedule.size() * sizeof(std::uint32_t));
+    append(stringOffsets.data(), stringOffsets.size() * sizeof(std::uint32_t));
+    for (const std::string& s : strings) {
+        append(s.data(), s.size());
+    }
+    return out;
+}
+
+template <typename T>
+void save_expressions(const std::string& path, const std::vector<std::pair<std::string, Expression<T>>>& roots) {
+    std::string data = serialize_expressions(roots);
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.write(data.data(), data.size()) || !file.flush()) {
+        throw std::runtime_error("Cannot write serialized expressions: " + path);
+    }
+}
+
+template <typename T>
+MappedExpressions<T>::MappedExpressions(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open serialized expressions: " + path);
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(serialized::Header)) {
+        ::close(fd);
+        throw std::runtime_error("Not a serialized expression file: " + path);
+    }
+    size_ = static_cast<size_t>(info.st_size);
+    void* mapping = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Cannot map serialized expressions: " + path);
+    }
+    mapping_ = mapping;
+
+    try {
+        const char* base = static_cast<const char*>(mapping_);
+        std::memcpy(&header_, base, sizeof(header_));
+        if (std::memcmp(header_.magic, serialized::magic, sizeof(header_.magic)) != 0) {
+            throw std::runtime_error("Not a serialized expression file: " + path);
+        }
+        if (header_.byte_order != serialized::byte_order) {
+            throw std::runtime_error("Serialized expressions have a different byte order");
+        }
+        if (header_.version != serialized::version) {
+            throw std::runtime_error("Unsupported serialized expression version " + std::to_string(header_.version));
+        }
+        if (header_.value_type != serialized::value_type<T>() || header_.value_size != sizeof(T)) {
+            throw std::runtime_error("Serialized expressions hold a different value type");
+        }
+        serialized::Layout layout = serialized::layout(header_);
+        if (layout.end != size_) {
+            throw std::runtime_error("Serialized expression file is truncated or corrupt");
+        }
+
+        // The mapping is page aligned and every section offset is a multiple
+        // of its element alignment, so the sections are used in place.
+        constants_ = reinterpret_cast<const T*>(base + layout.constants);
+        nodes_ = reinterpret_cast<const serialized::Node*>(base + layout.nodes);
+        roots_ = reinterpret_cast<const serialized::Root*>(base + layout.roots);
+        schedule_ = reinterpret_cast<const std::uint32_t*>(base + layout.schedule);
+        string_offsets_ = reinterpret_cast<const std::uint32_t*>(base + layout.string_offsets);
+        strings_ = base + layout.strings;
+        validate();
+    } catch (...) {
+        ::munmap(mapping_, size_);
+        throw;
+    }
+
+    registers_.resize(header_.node_count);
+    bindings_.resize(header_.variable_count);
+}
+
+template <typename T>
+MappedExpressions<T>::~MappedExpressions() {
+    ::munmap(mapping_, size_);
+}
+
+template <typename T>
+void MappedExpressions<T>::validate() const {
+    auto corrupt = [] {
+        return std::runtime_error("Serialized expression file is truncated or corrupt");
+    };
+
+    if (header_.variable_count > header_.string_count || string_offsets_[0] != 0 ||
+        string_offsets_[header_.string_count] != header_.string_bytes) {
+        throw corrupt();
+    }
+    for (std::uint32_t i = 0; i < header_.string_count; ++i) {
+        if (string_offsets_[i] > string_offsets_[i + 1]) {
+            throw corrupt();
+        }
+    }
+
+    for (std::uint32_t i = 0; i < header_.node_count; ++i) {
+        const serialized::Node& node = nodes_[i];
+        bool valid;
+        switch (node.type) {
+            case Type::Number:
+                valid = node.lhs < header_.constant_count;
+                break;
+            case Type::Variable:
+                valid = node.lhs < header_.variable_count;
+                break;
+            case Type::Sin:
+            case Type::Cos:
+            case Type::Ln:
+            case Type::Exp:
+                valid = node.lhs < i;
+                break;
+            case Type::Addition:
+            case Type::Subtraction:
+            case Type::Multiplication:
+            case Type::Division:
+            case Type::Exponentiation:
+                valid = node.lhs < i && node.rhs < i;
+                break;
+            default:
+                valid = false;
+                break;
+        }
+        if (!valid) {
+            throw corrupt();
+        }
+    }
+
+    for (std::uint32_t i = 0; i < header_.schedule_length; ++i) {
+        if ((schedule_[i] & ~serialized::check_divisor) >= header_.node_count) {
+            throw corrupt();
+        }
+    }
+    for (std::uint32_t i = 0; i < header_.root_count; ++i) {
+        const serialized::Root& root = roots_[i];
+        if (root.label < header_.variable_count || root.label >= header_.string_count ||
+            root.schedule_begin >= root.schedule_end || root.schedule_end > header_.schedule_length ||
+            schedule_[root.schedule_end - 1] != root.node) {
+            throw corrupt();
+        }
+    }
+}
+
+template <typename T>
+std::string_view MappedExpressions<T>::string(std::uint32_t index) const {
+    return std::string_view(strings_ + string_offsets_[index], string_offsets_[index + 1] - string_offsets_[index]);
+}
+
+template <typename T>
+const serialized::Root& MappedExpressions<T>::rootAt(size_t root) const {
+    if (root >= header_.root_count) {
+        throw std::runtime_error("Root index out of range: " + std::to_string(root));
+    }
+    return roots_[root];
+}
+
+template <typename T>
+size_t MappedExpressions<T>::root_count() const {
+    return header_.root_count;
+}
+
+template <typename T>
+std::string_view MappedExpressions<T>::label(size_t root) const {
+    return string(rootAt(root).label);
+}
+
+template <typename T>
+size_t MappedExpressions<T>::root(std::string_view label) const {
+    for (size_t i = 0; i < header_.root_count; ++i) {
+        if (string(roots_[i].label) == label) {
+            return i;
+        }
+    }
+    throw std::runtime_error("Root not found: " + std::string(label));
+}
+
+template <typename T>
+size_t MappedExpressions<T>::variable_count() const {
+    return header_.variable_count;
+}
+
+template <typename T>
+std::string_view MappedExpressions<T>::variable(size_t slot) const {
+    if (slot >= header_.variable_count) {
+        throw std::runtime_error("Variable slot out of range: " + std::to_string(slot));
+    }
+    return string(static_cast<std::uint32_t>(slot));
+}
+
+template <typename T>
+size_t MappedExpressions<T>::slot(std::string_view name) const {
+    for (std::uint32_t i = 0; i < header_.variable_count; ++i) {
+        if (string(i) == name) {
+            return i;
+        }
+    }
+    throw std::runtime_error("Variable not found: " + std::string(name));
+}
+
+template <typename T>
+size_t MappedExpressions<T>::node_count() const {
+    return header_.node_count;
+}
+
+template <typename T>
+T MappedExpressions<T>::evaluate(size_t root, const T* values) {
+    return evaluate(root, values, registers_.data());
+}
+
+template <typename T>
+T MappedExpressions<T>::evaluate(size_t root, const T* values, T* registers) const {
+    const serialized::Root& record = rootAt(root);
+    const std::uint32_t* end = schedule_ + record.schedule_end;
+    for (const std::uint32_t* entry = schedule_ + record.schedule_begin; entry != end; ++entry) {
+        const std::uint32_t i = *entry;
+        if (i & serialized::check_divisor) {
+            if (registers[i & ~serialized::check_divisor] == T(0)) {
+                throw std::runtime_error("Division by zero");
+            }
+            continue;
+        }
+        const serialized::Node& node = nodes_[i];
+        switch (node.type) {
+            case Type::Number:
+                registers[i] = constants_[node.lhs];
+                break;
+            case Type::Variable:
+                registers[i] = values[node.lhs];
+                break;
+            case Type::Addition:
+                registers[i] = registers[node.lhs] + registers[node.rhs];
+                break;
+            case Type::Subtraction:
+                registers[i] = registers[node.lhs] - registers[node.rhs];
+                break;
+            case Type::Multiplication:
+                registers[i] = registers[node.lhs] * registers[node.rhs];
+                break;
+            case Type::Division:
+                registers[i] = registers[node.lhs] / registers[node.rhs];
+                break;
+            case Type::Exponentiation:
+                registers[i] = static_cast<T>(std::pow(registers[node.lhs], registers[node.rhs]));
+                break;
+            case Type::Sin:
+                registers[i] = static_cast<T>(std::sin(registers[node.lhs]));
+                break;
+            case Type::Cos:
+                registers[i] = static_cast<T>(std::cos(registers[node.lhs]));
+                break;
+            case Type::Ln:
+                registers[i] = CompiledExpression<T>::checkedLn(registers[node.lhs]);
+                break;
+            case Type::Exp:
+                registers[i] = static_cast<T>(std::exp(registers[node.lhs]));
+                break;
+        }
+    }
+    return registers[record.node];
+}
+
+template <typename T>
+T MappedExpressions<T>::calculate(size_t root, const std::unordered_map<std::string, T>& variables) {
+    const serialized::Root& record = rootAt(root);
+    std::vector<bool> missing(header_.variable_count, false);
+    bool anyMissing = false;
+    for (std::uint32_t i = 0; i < header_.variable_count; ++i) {
+        auto it = variables.find(std::string(string(i)));
+        if (it == variables.end()) {
+            missing[i] = anyMissing = true;
+        } else {
+            bindings_[i] = it->second;
+        }
+    }
+    // Other roots may use variables this one does not need.
+    if (anyMissing) {
+        for (std::uint32_t k = record.schedule_begin; k < record.schedule_end; ++k) {
+            const std::uint32_t i = schedule_[k];
+            if (!(i & serialized::check_divisor) && nodes_[i].type == Type::Variable && missing[nodes_[i].lhs]) {
+                throw std::runtime_error("Variable not found: " + std::string(string(nodes_[i].lhs)));
+            }
+        }
+    }
+    return evaluate(root, bindings_.data());
+}
+
+template <typename T>
+Expression<T> MappedExpressions<T>::expression(size_t root) const {
+    const serialized::Root& record = rootAt(root);
+    std::unordered_map<std::uint32_t, Expression<T>> built;
+    for (std::uint32_t k = record.schedule_begin; k < record.schedule_end; ++k) {
+        const std::uint32_t i = schedule_[k];
+        if (i & serialized::check_divisor) {
+            continue;
+        }
+        const serialized::Node& node = nodes_[i];
+        const Type type = static_cast<Type>(node.type);
+        switch (type) {
+            case Type::Number:
+                built.emplace(i, Expression<T>(constants_[node.lhs]));
+                break;
+            case Type::Variable:
+                built.emplace(i, Expression<T>(std::string(string(node.lhs))));
+                break;
+            case Type::Sin:
+            case Type::Cos:
+            case Type::Ln:
+            case Type::Exp:
+                built.emplace(i, Expression<T>(type, built.at(node.lhs)));
+                break;
+            default:
+                built.emplace(i, Expression<T>(type, built.at(node.lhs), built.at(node.rhs)));
+                break;
+        }
+    }
+    return built.at(record.node);
+}
+
+#endif
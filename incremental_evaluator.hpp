@@ -0,0 +1,56 @@
+#ifndef INCREMENTAL_EVALUATOR_HPP
+#define INCREMENTAL_EVALUATOR_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "compiled_expression.hpp"
+
+// Keeps the value of every node between evaluations. After set() changes
+// some bindings, evaluate() recomputes only the nodes that depend on them,
+// in program order, and stops along a path as soon as a node comes out
+// bit-identical to its cached value. The result is the one calculate()
+// would give for the current bindings, errors included.
+template <typename T>
+class IncrementalEvaluator {
+public:
+    explicit IncrementalEvaluator(const Expression<T>& expr);
+
+    const std::vector<std::string>& variables() const;
+    size_t slot(const std::string& name) const;
+
+    void set(size_t slot, const T& value);
+    void set(const std::string& name, const T& value);
+
+    // The first call, and the first call after an error, evaluates fully.
+    T evaluate();
+    T calculate(const std::unordered_map<std::string, T>& variables);
+
+    // Nodes whose value was computed by the last evaluate().
+    size_t recomputed_count() const;
+    size_t node_count() const;
+
+private:
+    using Instruction = typename CompiledExpression<T>::Instruction;
+
+    CompiledExpression<T> program_;
+    std::vector<std::uint32_t> consumer_offsets_;
+    std::vector<std::uint32_t> consumers_;
+    std::vector<std::vector<std::uint32_t>> readers_;
+    std::vector<T> registers_;
+    std::vector<T> values_;
+    std::vector<bool> bound_;
+    std::vector<std::uint32_t> changed_;
+    std::vector<std::uint32_t> queue_;
+    std::vector<bool> queued_;
+    size_t value_nodes_ = 0;
+    size_t recomputed_ = 0;
+    bool valid_ = false;
+
+    void enqueue(std::uint32_t index);
+};
+
+#include "incremental_evaluator.tpp"
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef INCREMENTAL_EVALUATOR_TPP
+#define INCREMENTAL_EVALUATOR_TPP
+
+#include "incremental_evaluator.hpp"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+
+template <typename T>
+IncrementalEvaluator<T>::IncrementalEvaluator(const Expression<T>& expr) : program_(expr) {
+    using OpCode = typename CompiledExpression<T>::OpCode;
+    const std::vector<Instruction>& code = program_.instructions();
+
+    // Consumers of every register in CSR form; a CheckDivisor consumes the
+    // divisor so that it is re-run whenever the divisor changes.
+    std::vector<std::uint32_t> counts(code.size() + 1, 0);
+    auto forEachOperand = [&code](size_t i, auto&& fn) {
+        const Instruction& ins = code[i];
+        switch (ins.op) {
+            case OpCode::Constant:
+            case OpCode::Variable:
+                break;
+            case OpCode::CheckDivisor:
+            case OpCode::Sin:
+            case OpCode::Cos:
+            case OpCode::Ln:
+            case OpCode::Exp:
+                fn(ins.lhs);
+                break;
+            default:
+                fn(ins.lhs);
+                if (ins.rhs != ins.lhs) {
+                    fn(ins.rhs);
+                }
+                break;
+        }
+    };
+    for (size_t i = 0; i < code.size(); ++i) {
+        forEachOperand(i, [&counts](std::uint32_t operand) { counts[operand + 1]++; });
+    }
+    for (size_t i = 0; i < code.size(); ++i) {
+        counts[i + 1] += counts[i];
+    }
+    consumer_offsets_ = counts;
+    consumers_.resize(counts.back());
+    for (size_t i = 0; i < code.size(); ++i) {
+        forEachOperand(i, [&](std::uint32_t operand) {
+            consumers_[counts[operand]++] = static_cast<std::uint32_t>(i);
+        });
+    }
+
+    readers_.resize(program_.variable_count());
+    for (size_t i = 0; i < code.size(); ++i) {
+        if (code[i].op == OpCode::Variable) {
+            readers_[code[i].lhs].push_back(static_cast<std::uint32_t>(i));
+        }
+        if (code[i].op != OpCode::CheckDivisor) {
+            value_nodes_++;
+        }
+    }
+
+    registers_.resize(code.size());
+    values_.resize(program_.variable_count());
+    bound_.assign(program_.variable_count(), false);
+    queued_.assign(code.size(), false);
+}
+
+template <typename T>
+const std::vector<std::string>& IncrementalEvaluator<T>::variables() const {
+    return program_.variables();
+}
+
+template <typename T>
+size_t IncrementalEvaluator<T>::slot(const std::string& name) const {
+    return program_.slot(name);
+}
+
+template <typename T>
+void IncrementalEvaluator<T>::set(size_t slot, const T& value) {
+    if (slot >= values_.size()) {
+        throw std::runtime_error("Variable slot out of range: " + std::to_string(slot));
+    }
+    // Compared bitwise: 0.0 and -0.0 must not be treated as the same binding.
+    if (bound_[slot] && std::memcmp(&values_[slot], &value, sizeof(T)) == 0) {
+        return;
+    }
+    values_[slot] = value;
+    bound_[slot] = true;
+    changed_.push_back(static_cast<std::uint32_t>(slot));
+}
+
+template <typename T>
+void IncrementalEvaluator<T>::set(const std::string& name, const T& value) {
+    set(program_.slot(name), value);
+}
+
+template <typename T>
+void IncrementalEvaluator<T>::enqueue(std::uint32_t index) {
+    if (!queued_[index]) {
+        queued_[index] = true;
+        queue_.push_back(index);
+        std::push_heap(queue_.begin(), queue_.end(), std::greater<std::uint32_t>());
+    }
+}
+
+template <typename T>
+T IncrementalEvaluator<T>::evaluate() {
+    const size_t size = registers_.size();
+    if (!valid_) {
+        for (size_t slot = 0; slot < bound_.size(); ++slot) {
+            if (!bound_[slot]) {
+                throw std::runtime_error("Variable not found: " + program_.variables()[slot]);
+            }
+        }
+        changed_.clear();
+        recomputed_ = 0;
+        T result = program_.evaluate(values_.data(), registers_.data());
+        recomputed_ = value_nodes_;
+        valid_ = true;
+        return result;
+    }
+
+    // Dependents always have larger indices, so taking the smallest queued
+    // index first runs every node after all of its changed operands.
+    for (std::uint32_t slot : changed_) {
+        for (std::uint32_t reader : readers_[slot]) {
+            enqueue(reader);
+        }
+    }
+    changed_.clear();
+    recomputed_ = 0;
+
+    const std::vector<Instruction>& code = program_.instructions();
+    try {
+        while (!queue_.empty()) {
+            std::pop_heap(queue_.begin(), queue_.end(), std::greater<std::uint32_t>());
+            const std::uint32_t i = queue_.back();
+            queue_.pop_back();
+            queued_[i] = false;
+
+            if (code[i].op == CompiledExpression<T>::OpCode::CheckDivisor) {
+                program_.execute(i, values_.data(), registers_.data());
+                continue;
+            }
+            const T previous = registers_[i];
+            program_.execute(i, values_.data(), registers_.data());
+            recomputed_++;
+            if (std::memcmp(&previous, &registers_[i], sizeof(T)) == 0) {
+                continue;
+            }
+            for (std::uint32_t k = consumer_offsets_[i]; k < consumer_offsets_[i + 1]; ++k) {
+                enqueue(consumers_[k]);
+            }
+        }
+    } catch (...) {
+        for (std::uint32_t index : queue_) {
+            queued_[index] = false;
+        }
+        queue_.clear();
+        valid_ = false;
+        throw;
+    }
+    return registers_[size - 1];
+}
+
+template <typename T>
+T IncrementalEvaluator<T>::calculate(const std::unordered_map<std::string, T>& variables) {
+    for (size_t slot = 0; slot < values_.size(); ++slot) {
+        auto it = variables.find(program_.variables()[slot]);
+        if (it == variables.end()) {
+            throw std::runtime_error("Variable not found: " + program_.variables()[slot]);
+        }
+        set(slot, it->second);
+    }
+    return evaluate();
+}
+
+template <typename T>
+size_t IncrementalEvaluator<T>::recomputed_count() const {
+    return recomputed_;
+}
+
+template <typename T>
+size_t IncrementalEvaluator<T>::node_count() const {
+    return value_nodes_;
+}
+
+#endif
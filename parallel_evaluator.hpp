@@ -0,0 +1,42 @@
+#ifndef PARALLEL_EVALUATOR_HPP
+#define PARALLEL_EVALUATOR_HPP
+
+#include <string>
+#include <vector>
+#include "batch_evaluator.hpp"
+#include "compiled_expression.hpp"
+#include "thread_pool.hpp"
+
+// Splits a large set of rows into chunks and evaluates them on a thread pool.
+// The compiled plan is shared read-only; every worker owns its workspace.
+template <typename T>
+class ParallelEvaluator {
+public:
+    static constexpr size_t default_chunk_rows = BatchEvaluator<T>::block_size * 64;
+
+    ParallelEvaluator(const CompiledExpression<T>& program, ThreadPool& pool,
+                      size_t chunk_rows = default_chunk_rows);
+
+    const std::vector<std::string>& variables() const;
+
+    // Same contract as BatchEvaluator::evaluate.
+    void evaluate(const T* const* columns, size_t rows, T* out, RowError* errors = nullptr);
+
+private:
+    BatchEvaluator<T> evaluator_;
+    ThreadPool& pool_;
+    size_t chunk_rows_;
+    std::vector<typename BatchEvaluator<T>::Workspace> workspaces_;
+};
+
+// Evaluates many independent programs (e.g. all partial derivatives) at the
+// same bindings. A program that fails yields BatchEvaluator<T>::invalid_value()
+// and, if errors is given, the exception message at its index.
+template <typename T>
+std::vector<T> evaluate_all(const std::vector<CompiledExpression<T>>& programs,
+                            const std::unordered_map<std::string, T>& variables, ThreadPool& pool,
+                            std::vector<std::string>* errors = nullptr);
+
+#include "parallel_evaluator.tpp"
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef PARALLEL_EVALUATOR_TPP
+#define PARALLEL_EVALUATOR_TPP
+
+#include "parallel_evaluator.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+template <typename T>
+ParallelEvaluator<T>::ParallelEvaluator(const CompiledExpression<T>& program, ThreadPool& pool, size_t chunk_rows)
+    : evaluator_(program), pool_(pool), chunk_rows_(std::max(chunk_rows, BatchEvaluator<T>::block_size)) {
+    for (size_t w = 0; w < pool_.size(); ++w) {
+        workspaces_.push_back(evaluator_.make_workspace());
+    }
+}
+
+template <typename T>
+const std::vector<std::string>& ParallelEvaluator<T>::variables() const {
+    return evaluator_.variables();
+}
+
+template <typename T>
+void ParallelEvaluator<T>::evaluate(const T* const* columns, size_t rows, T* out, RowError* errors) {
+    const size_t chunks = (rows + chunk_rows_ - 1) / chunk_rows_;
+    const size_t width = evaluator_.variables().size();
+
+    pool_.parallel_for(chunks, [&](size_t chunk, size_t worker) {
+        const size_t offset = chunk * chunk_rows_;
+        const size_t count = std::min(chunk_rows_, rows - offset);
+        std::vector<const T*> shifted(width);
+        for (size_t slot = 0; slot < width; ++slot) {
+            shifted[slot] = columns[slot] + offset;
+        }
+        evaluator_.evaluate(shifted.data(), count, out + offset, errors ? errors + offset : nullptr,
+                            workspaces_[worker]);
+    });
+}
+
+template <typename T>
+std::vector<T> evaluate_all(const std::vector<CompiledExpression<T>>& programs,
+                            const std::unordered_map<std::string, T>& variables, ThreadPool& pool,
+                            std::vector<std::string>* errors) {
+    std::vector<T> results(programs.size());
+    if (errors) {
+        errors->assign(programs.size(), std::string());
+    }
+
+    size_t registers = 0;
+    for (const CompiledExpression<T>& program : programs) {
+        registers = std::max(registers, program.register_count());
+    }
+    std::vector<std::vector<T>> scratch(pool.size(), std::vector<T>(registers));
+
+    pool.parallel_for(programs.size(), [&](size_t index, size_t worker) {
+        const CompiledExpression<T>& program = programs[index];
+        std::vector<T> values(program.variable_count());
+        try {
+            for (size_t slot = 0; slot < values.size(); ++slot) {
+                auto it = variables.find(program.variables()[slot]);
+                if (it == variables.end()) {
+                    throw std::runtime_error("Variable not found: " + program.variables()[slot]);
+                }
+                values[slot] = it->second;
+            }
+            results[index] = program.evaluate(values.data(), scratch[worker].data());
+        } catch (const std::runtime_error& e) {
+            results[index] = BatchEvaluator<T>::invalid_value();
+            if (errors) {
+                (*errors)[index] = e.what();
+            }
+        }
+    });
+    return results;
+}
+
+#endif
@@ -0,0 +1,289 @@
+#ifndef STATIC_EXPRESSION_HPP
+#define STATIC_EXPRESSION_HPP
+
+#include <cmath>
+#include <complex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include "compiled_expression.hpp"
+#include "expression.hpp"
+
+// Expression templates for formulas fixed at build time. The formula is
+// encoded in the type, so evaluation inlines into straight-line code without
+// allocation, and derivative<Var>() applies the rules of
+// Expression::differentiate during compilation. to_expression<T>() converts
+// to the runtime representation.
+//
+//     constexpr static_expr::Var<'x'> x;
+//     auto f = x * sin(x) + 2.0;
+//     double v = static_expr::evaluate<double>(f, x = 1.5);
+//     auto df = static_expr::derivative<decltype(x)>(f);
+namespace static_expr {
+
+template <typename V, typename U>
+struct Binding {
+    using variable = V;
+    U value;
+};
+
+template <typename E>
+struct is_node : std::false_type {};
+
+template <typename E>
+constexpr bool is_node_v = is_node<std::decay_t<E>>::value;
+
+template <typename V, typename B, typename... Bs>
+constexpr const auto& find_binding(const B& first, const Bs&... rest) {
+    if constexpr (std::is_same_v<typename B::variable, V>) {
+        return first.value;
+    } else {
+        static_assert(sizeof...(Bs) > 0, "Variable not bound");
+        return find_binding<V>(rest...);
+    }
+}
+
+template <char... Name>
+struct Var {
+    static std::string name() {
+        return std::string{Name...};
+    }
+
+    template <typename U>
+    constexpr Binding<Var, U> operator=(U value) const {
+        return {value};
+    }
+
+    template <typename T, typename... Bs>
+    constexpr T eval(const Bs&... bindings) const {
+        static_assert(sizeof...(Bs) > 0, "Variable not bound");
+        return T(find_binding<Var>(bindings...));
+    }
+};
+
+template <typename U>
+struct Constant {
+    U value;
+
+    template <typename T, typename... Bs>
+    constexpr T eval(const Bs&...) const {
+        return T(value);
+    }
+};
+
+struct Add {};
+struct Sub {};
+struct Mul {};
+struct Div {};
+struct Pow {};
+struct Sin {};
+struct Cos {};
+struct Ln {};
+struct Exp {};
+
+template <typename Op, typename L, typename R>
+struct Binary {
+    L left;
+    R right;
+
+    template <typename T, typename... Bs>
+    constexpr T eval(const Bs&... bindings) const {
+        if constexpr (std::is_same_v<Op, Div>) {
+            // The divisor is evaluated (and checked) first, as in calculate().
+            T divisor = right.template eval<T>(bindings...);
+            if (divisor == T(0)) {
+                throw std::runtime_error("Division by zero");
+            }
+            return left.template eval<T>(bindings...) / divisor;
+        } else {
+            T a = left.template eval<T>(bindings...);
+            T b = right.template eval<T>(bindings...);
+            if constexpr (std::is_same_v<Op, Add>) {
+                return a + b;
+            } else if constexpr (std::is_same_v<Op, Sub>) {
+                return a - b;
+            } else if constexpr (std::is_same_v<Op, Mul>) {
+                return a * b;
+            } else {
+                return static_cast<T>(std::pow(a, b));
+            }
+        }
+    }
+};
+
+template <typename Op, typename A>
+struct Unary {
+    A argument;
+
+    template <typename T, typename... Bs>
+    constexpr T eval(const Bs&... bindings) const {
+        T a = argument.template eval<T>(bindings...);
+        if constexpr (std::is_same_v<Op, Sin>) {
+            return static_cast<T>(std::sin(a));
+        } else if constexpr (std::is_same_v<Op, Cos>) {
+            return static_cast<T>(std::cos(a));
+        } else if constexpr (std::is_same_v<Op, Ln>) {
+            return CompiledExpression<T>::checkedLn(a);
+        } else {
+            return static_cast<T>(std::exp(a));
+        }
+    }
+};
+
+template <char... Name>
+struct is_node<Var<Name...>> : std::true_type {};
+template <typename U>
+struct is_node<Constant<U>> : std::true_type {};
+template <typename Op, typename L, typename R>
+struct is_node<Binary<Op, L, R>> : std::true_type {};
+template <typename Op, typename A>
+struct is_node<Unary<Op, A>> : std::true_type {};
+
+template <typename E>
+constexpr auto as_node(const E& e) {
+    if constexpr (is_node_v<E>) {
+        return e;
+    } else {
+        return Constant<E>{e};
+    }
+}
+
+template <typename L, typename R>
+constexpr bool operands_v = (is_node_v<L> || is_node_v<R>) &&
+                            (is_node_v<L> || std::is_arithmetic_v<L>) &&
+                            (is_node_v<R> || std::is_arithmetic_v<R>);
+
+template <typename Op, typename L, typename R>
+constexpr auto make_binary(const L& l, const R& r) {
+    auto a = as_node(l);
+    auto b = as_node(r);
+    return Binary<Op, decltype(a), decltype(b)>{a, b};
+}
+
+template <typename L, typename R, typename = std::enable_if_t<operands_v<L, R>>>
+constexpr auto operator+(const L& l, const R& r) {
+    return make_binary<Add>(l, r);
+}
+
+template <typename L, typename R, typename = std::enable_if_t<operands_v<L, R>>>
+constexpr auto operator-(const L& l, const R& r) {
+    return make_binary<Sub>(l, r);
+}
+
+template <typename L, typename R, typename = std::enable_if_t<operands_v<L, R>>>
+constexpr auto operator*(const L& l, const R& r) {
+    return make_binary<Mul>(l, r);
+}
+
+template <typename L, typename R, typename = std::enable_if_t<operands_v<L, R>>>
+constexpr auto operator/(const L& l, const R& r) {
+    return make_binary<Div>(l, r);
+}
+
+// Like Expression::operator^, this binds looser than * in C++; parenthesize.
+template <typename L, typename R, typename = std::enable_if_t<operands_v<L, R>>>
+constexpr auto operator^(const L& l, const R& r) {
+    return make_binary<Pow>(l, r);
+}
+
+template <typename A, typename = std::enable_if_t<is_node_v<A>>>
+constexpr auto sin(const A& a) {
+    return Unary<Sin, A>{a};
+}
+
+template <typename A, typename = std::enable_if_t<is_node_v<A>>>
+constexpr auto cos(const A& a) {
+    return Unary<Cos, A>{a};
+}
+
+template <typename A, typename = std::enable_if_t<is_node_v<A>>>
+constexpr auto ln(const A& a) {
+    return Unary<Ln, A>{a};
+}
+
+template <typename A, typename = std::enable_if_t<is_node_v<A>>>
+constexpr auto exp(const A& a) {
+    return Unary<Exp, A>{a};
+}
+
+template <typename T, typename E, typename... Bs>
+constexpr T evaluate(const E& e, const Bs&... bindings) {
+    return e.template eval<T>(bindings...);
+}
+
+// Same rules, in the same shape, as Expression::differentiate.
+template <typename V, typename U>
+constexpr auto derivative(const Constant<U>&) {
+    return Constant<int>{0};
+}
+
+template <typename V, char... Name>
+constexpr auto derivative(const Var<Name...>&) {
+    return Constant<int>{std::is_same_v<std::remove_cv_t<V>, Var<Name...>> ? 1 : 0};
+}
+
+template <typename V, typename Op, typename L, typename R>
+constexpr auto derivative(const Binary<Op, L, R>& e) {
+    auto dl = derivative<V>(e.left);
+    auto dr = derivative<V>(e.right);
+    if constexpr (std::is_same_v<Op, Add>) {
+        return dl + dr;
+    } else if constexpr (std::is_same_v<Op, Sub>) {
+        return dl - dr;
+    } else if constexpr (std::is_same_v<Op, Mul>) {
+        return (dl * e.right) + (e.left * dr);
+    } else if constexpr (std::is_same_v<Op, Div>) {
+        return (dl * e.right - (e.left * dr)) / (e.right ^ Constant<int>{2});
+    } else {
+        return (e.left ^ e.right) * (dr * ln(e.left) + (e.right * dl) / e.left);
+    }
+}
+
+template <typename V, typename Op, typename A>
+constexpr auto derivative(const Unary<Op, A>& e) {
+    auto da = derivative<V>(e.argument);
+    if constexpr (std::is_same_v<Op, Sin>) {
+        return cos(e.argument) * da;
+    } else if constexpr (std::is_same_v<Op, Cos>) {
+        return Constant<int>{-1} * sin(e.argument) * da;
+    } else if constexpr (std::is_same_v<Op, Ln>) {
+        return da / e.argument;
+    } else {
+        return exp(e.argument) * da;
+    }
+}
+
+template <typename T, char... Name>
+Expression<T> to_expression(const Var<Name...>&) {
+    return Expression<T>(Var<Name...>::name());
+}
+
+template <typename T, typename U>
+Expression<T> to_expression(const Constant<U>& e) {
+    return Expression<T>(T(e.value));
+}
+
+template <typename T, typename Op, typename L, typename R>
+Expression<T> to_expression(const Binary<Op, L, R>& e) {
+    using Type = typename Expression<T>::Type;
+    Type type = std::is_same_v<Op, Add> ? Type::Addition
+              : std::is_same_v<Op, Sub> ? Type::Subtraction
+              : std::is_same_v<Op, Mul> ? Type::Multiplication
+              : std::is_same_v<Op, Div> ? Type::Division
+              : Type::Exponentiation;
+    return Expression<T>(type, to_expression<T>(e.left), to_expression<T>(e.right));
+}
+
+template <typename T, typename Op, typename A>
+Expression<T> to_expression(const Unary<Op, A>& e) {
+    using Type = typename Expression<T>::Type;
+    Type type = std::is_same_v<Op, Sin> ? Type::Sin
+              : std::is_same_v<Op, Cos> ? Type::Cos
+              : std::is_same_v<Op, Ln> ? Type::Ln
+              : Type::Exp;
+    return Expression<T>(type, to_expression<T>(e.argument));
+}
+
+}  // namespace static_expr
+
+#endif
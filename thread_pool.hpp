@@ -0,0 +1,163 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads with one task deque each. A parallel_for
+// deals the indices out to the deques up front; a worker drains its own
+// deque from the back and, once empty, steals from the front of the others.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads = 0) {
+        if (threads == 0) {
+            threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+        }
+        for (size_t i = 0; i < threads; ++i) {
+            queues_.push_back(std::make_unique<Queue>());
+        }
+        for (size_t i = 0; i < threads; ++i) {
+            workers_.emplace_back([this, i] { run(i); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (std::thread& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const {
+        return workers_.size();
+    }
+
+    // Calls task(index, worker) for every index in [0, count) and waits for
+    // all of them. `worker` is below size() and identifies the calling
+    // thread, so callers can keep per-worker scratch state. The first
+    // exception thrown by a task is rethrown here.
+    void parallel_for(size_t count, const std::function<void(size_t, size_t)>& task) {
+        if (count == 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> run_lock(run_mutex_);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        task_ = &task;
+        pending_ = count;
+        error_ = nullptr;
+        lock.unlock();
+
+        const size_t threads = workers_.size();
+        for (size_t w = 0; w < threads; ++w) {
+            std::lock_guard<std::mutex> queue_lock(queues_[w]->mutex);
+            for (size_t index = count * w / threads; index < count * (w + 1) / threads; ++index) {
+                queues_[w]->tasks.push_back(index);
+            }
+        }
+
+        lock.lock();
+        generation_++;
+        wake_.notify_all();
+        done_.wait(lock, [this] { return pending_ == 0; });
+        task_ = nullptr;
+
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex run_mutex_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    const std::function<void(size_t, size_t)>* task_ = nullptr;
+    size_t pending_ = 0;
+    size_t generation_ = 0;
+    bool stop_ = false;
+    std::exception_ptr error_;
+
+    bool take(size_t worker, size_t& index) {
+        {
+            Queue& own = *queues_[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                index = own.tasks.back();
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t k = 1; k < queues_.size(); ++k) {
+            Queue& victim = *queues_[(worker + k) % queues_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                index = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(size_t worker) {
+        size_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this, seen] { return stop_ || generation_ != seen; });
+                if (stop_) {
+                    return;
+                }
+                seen = generation_;
+            }
+
+            // The task is looked up per index: a worker still draining may
+            // already be picking up indices of the next parallel_for.
+            size_t index;
+            while (take(worker, index)) {
+                const std::function<void(size_t, size_t)>* task;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    task = task_;
+                }
+                try {
+                    (*task)(index, worker);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (!error_) {
+                        error_ = std::current_exception();
+                    }
+                }
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (--pending_ == 0) {
+                    done_.notify_all();
+                }
+            }
+        }
+    }
+};
+
+#endif